@@ -1,14 +1,16 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <tuple>
 #include <type_traits>
 #include <utility>
 #include <vector>
 #include <iostream>
 #include <iomanip>
+#include <cstdint>
 #include <cstring>
 
-#include <cxxabi.h>
+#include "format.hpp"
 
 namespace pwn {
 
@@ -34,95 +36,108 @@ namespace detail {
 	}
 }
 
-template<typename ...Args>
-std::string format(std::string format, Args ...arglist) {
-	enum State {
-		NORMAL = 0,
-		ESCAPE,
-		BEGIN,
-	};
-
-	State state = NORMAL;
-
-	std::string s2(format);
-	std::vector<std::string> formatted {detail::stringify(arglist) ...};
-
-	int argid = 0;
-	std::size_t position = 0;
-	for (auto itr = format.begin(); itr != format.end(); itr++, position++) {
-		switch (*itr) {
-			case '\\':
-				state = ESCAPE;
-				s2.erase(position--, 1);
-				break;
-			case '{':
-				if (state != ESCAPE)
-					state = BEGIN;
-				break;
-			case '}':
-				if (state == BEGIN) {
-					s2.erase(position - 1, 2);
-					s2.insert(position - 1, formatted[argid]);
-					position += formatted[argid].length() - 2;
-					argid++;
-				}
-			default:
-				state = NORMAL;
+namespace detail {
+	/*
+		Writes the sizeof(T) bytes of value to out, least significant byte first unless big is set.
+	*/
+	template<typename T>
+	constexpr void pack(char *out, T value, bool big = false) {
+		for (std::size_t i = 0; i < sizeof(T); i++) {
+			char byte = static_cast<char>(static_cast<std::uint64_t>(value) >> (8 * i) & 0xff);
+			out[big ? sizeof(T) - 1 - i : i] = byte;
 		}
 	}
-	return s2;
-}
 
-std::string p64(std::uint64_t value) {
-	std::string s("");
-	s.resize(8);
+	template<typename T>
+	std::string packed(T value, bool big = false) {
+		std::string s(sizeof(T), '\0');
+		pack<T>(s.data(), value, big);
 
-	for (char i = 0; i < 8; i++) {
-		s += static_cast<unsigned char>(value >> (8 * i) & 0xff);
+		return s;
 	}
+}
 
-	return s;
+std::string p64(std::uint64_t value) {
+	return detail::packed<std::uint64_t>(value);
 }
 
 std::string p32(std::uint32_t value) {
-	std::string s("");
-	s.resize(4);
+	return detail::packed<std::uint32_t>(value);
+}
 
+inline std::string p16(std::uint16_t value) {
+	return detail::packed<std::uint16_t>(value);
+}
+
+inline std::string p8(std::uint8_t value) {
+	return detail::packed<std::uint8_t>(value);
+}
 
-	for (char i = 0; i < 4; i++) {
-		s += static_cast<unsigned char>(value >> (8 * i) & 0xff);
+namespace detail {
+	template<typename T>
+	T unpacked(std::string_view bytes, bool big = false) {
+		if (bytes.length() > sizeof(T))
+			throw std::runtime_error(pwn::format("Can not unpack {} bytes into a {} byte word", bytes.length(), sizeof(T)));
+
+		T value = 0;
+		for (std::size_t i = 0; i < bytes.length(); i++) {
+			std::size_t shift = big ? bytes.length() - 1 - i : i;
+			value |= static_cast<T>(static_cast<std::uint8_t>(bytes[i])) << (8 * shift);
+		}
+
+		return value;
 	}
+}
 
-	return s;
+/*
+	Shorter input is zero extended, so a leak read with recvuntil can be unpacked directly.
+*/
+inline std::uint64_t u64(std::string_view bytes) {
+	return detail::unpacked<std::uint64_t>(bytes);
 }
 
-std::string demanglecpp(std::string identifier) {
-	int status = 0;
-	const char *demangled = abi::__cxa_demangle(identifier.c_str(), nullptr, nullptr, &status);
-
-	switch (status) {
-		case -2:
-			return identifier;
-		case -1:
-			throw std::runtime_error(pwn::format("memory error occured during demangling of {}", identifier));
-		default:
-			throw std::runtime_error(pwn::format("Unknown error when demangling {}", identifier));
-		case 0:
-			break;
-	}
+inline std::uint32_t u32(std::string_view bytes) {
+	return detail::unpacked<std::uint32_t>(bytes);
+}
+
+inline std::uint16_t u16(std::string_view bytes) {
+	return detail::unpacked<std::uint16_t>(bytes);
+}
 
-	std::string s("");
+inline std::uint8_t u8(std::string_view bytes) {
+	return detail::unpacked<std::uint8_t>(bytes);
+}
 
-	for (std::size_t i = 0; i < strlen(demangled); i++) {
-		if ((demangled[i] == ' ') && (i > 0) && ((demangled[i - 1] == '<') || (demangled[i - 1] == '>')))
-			continue;
-		
-		s += demangled[i];
+/*
+	Decodes every whole little endian word of bytes into out, which must have room for
+	bytes.length() / sizeof(T) words. A trailing partial word is ignored.
+*/
+template<typename T>
+std::size_t unpack_into(std::string_view bytes, T *out, bool big = false) {
+	std::size_t count = bytes.length() / sizeof(T);
+
+	std::memcpy(out, bytes.data(), count * sizeof(T));
+
+	if (big) {
+		for (std::size_t i = 0; i < count; i++) {
+			if constexpr (sizeof(T) == 8)
+				out[i] = __builtin_bswap64(out[i]);
+			else if constexpr (sizeof(T) == 4)
+				out[i] = __builtin_bswap32(out[i]);
+			else if constexpr (sizeof(T) == 2)
+				out[i] = __builtin_bswap16(out[i]);
+		}
 	}
 
-	free(const_cast<char *>(demangled));
+	return count;
+}
+
+template<typename T = std::uint64_t>
+std::vector<T> unpack(std::string_view bytes, bool big = false) {
+	std::vector<T> words(bytes.length() / sizeof(T));
+	unpack_into<T>(bytes, words.data(), big);
 
-	return s;
+	return words;
 }
 
 }
\ No newline at end of file
@@ -0,0 +1,147 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace pwn {
+
+namespace detail {
+
+/*
+	An arbitrary set of byte values which can split a buffer into maximal runs of members.
+	With AVX2 membership of 32 bytes is tested at once with two nibble lookups: the low nibble
+	selects a row of 8 bits (one per high nibble, in two tables for high nibbles 0-7 and 8-15)
+	and the high nibble selects the bit within the row.
+*/
+class byte_set {
+private:
+	bool member[256] = {};
+	std::uint8_t rows_low[16] = {};
+	std::uint8_t rows_high[16] = {};
+
+public:
+	byte_set() {}
+	byte_set(std::string_view bytes) {
+		for (char c : bytes)
+			insert(static_cast<std::uint8_t>(c));
+	}
+
+	void insert(std::uint8_t c) {
+		member[c] = true;
+
+		if (c < 0x80)
+			rows_low[c & 0xf] |= 1 << (c >> 4);
+		else
+			rows_high[c & 0xf] |= 1 << ((c >> 4) - 8);
+	}
+
+	bool contains(std::uint8_t c) const {
+		return member[c];
+	}
+
+	/* calls found(begin, end) for every maximal run of members at least min_length long */
+	template<typename Callback>
+	void for_each_run(std::string_view buffer, std::size_t min_length, Callback &&found) const {
+		constexpr std::size_t npos = -1;
+
+		const std::uint8_t *data = reinterpret_cast<const std::uint8_t *>(buffer.data());
+		std::size_t run_start = npos;
+		std::size_t i = 0;
+
+		auto close_run = [&](std::size_t end) {
+			if (end - run_start >= min_length)
+				found(run_start, end);
+			run_start = npos;
+		};
+
+#if defined(__AVX2__)
+		const __m256i low_table = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(rows_low)));
+		const __m256i high_table = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(rows_high)));
+		const __m256i bit_table = _mm256_setr_epi8(
+			1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128,
+			1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+		const __m256i nibble = _mm256_set1_epi8(0x0f);
+		const __m256i seven = _mm256_set1_epi8(7);
+
+		auto members = [&](std::size_t offset) -> std::uint32_t {
+			__m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + offset));
+			__m256i low = _mm256_and_si256(bytes, nibble);
+			__m256i high = _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble);
+
+			__m256i row = _mm256_blendv_epi8(
+				_mm256_shuffle_epi8(low_table, low),
+				_mm256_shuffle_epi8(high_table, low),
+				_mm256_cmpgt_epi8(high, seven));
+			__m256i bit = _mm256_shuffle_epi8(bit_table, high);
+
+			return _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(row, bit), bit));
+		};
+
+		/* outside of a run only positions followed by enough members (looking into the next block) can start one */
+		std::size_t window = std::max<std::size_t>(1, std::min<std::size_t>(min_length, 32));
+
+		if (buffer.length() >= 64) {
+			std::uint32_t mask = members(0);
+
+			for (; i + 64 <= buffer.length(); i += 32) {
+				std::uint32_t next = members(i + 32);
+				std::size_t position = 0;
+
+				if (run_start == npos) {
+					std::uint64_t combined = mask | static_cast<std::uint64_t>(next) << 32;
+					std::uint64_t starts = combined;
+
+					for (std::size_t j = 1; j < window; j++)
+						starts &= combined >> j;
+
+					if (!static_cast<std::uint32_t>(starts)) {
+						mask = next;
+						continue;
+					}
+
+					position = __builtin_ctz(static_cast<std::uint32_t>(starts));
+					run_start = i + position;
+				}
+
+				while (position < 32) {
+					std::uint32_t rest = (run_start == npos ? mask : ~mask) >> position;
+
+					if (!rest)
+						break;
+
+					position += __builtin_ctz(rest);
+
+					if (run_start == npos)
+						run_start = i + position;
+					else
+						close_run(i + position);
+				}
+
+				mask = next;
+			}
+		}
+#endif
+
+		for (; i < buffer.length(); i++) {
+			if (member[data[i]] == (run_start != npos))
+				continue;
+
+			if (run_start == npos)
+				run_start = i;
+			else
+				close_run(i);
+		}
+
+		if (run_start != npos)
+			close_run(buffer.length());
+	}
+};
+
+}
+
+}
@@ -9,5 +9,6 @@ enum pwnflag : std::size_t {
 	bit64 = 8,
 	remote = 2,
 	local = 16,
+	uring = 32,
 };
 }
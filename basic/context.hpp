@@ -1,27 +1,91 @@
 #pragma once
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "cyclic.hpp"
+#include "shared_cyclic.hpp"
 
 namespace pwn {
 
 class context {
 private:
 	pwn::cyclic cyclic_context;
+	pwn::shared_cyclic *shared = nullptr;
+	std::size_t owner = 0;
+	std::size_t walks = 0;
+
+	/*
+		Start of the next amount characters, claimed from the shared sequence if there is one.
+		Throws before recording anything if they do not fit, so nothing of them is handed out.
+	*/
+	std::uint64_t cyclic_claim(std::size_t amount) {
+		if (shared) {
+			std::uint64_t pos = shared->walk(owner, walks, amount);
+			walks++;
+
+			return pos;
+		}
+
+		std::uint64_t pos = cyclic_context.get_pos();
+		if (amount > cyclic_context.get_length() - pos)
+			throw std::runtime_error("cyclic pattern exhausted, use a larger alphabet or order");
+
+		cyclic_context.walk(amount);
+
+		return pos;
+	}
 public:
 	context(std::size_t bitwidth) : cyclic_context(bitwidth) {}
 
+	/*
+		Walk cyclic data in a sequence shared with other contexts from now on, see pwn::shared_cyclic.
+		Data walked before is no longer findable through this context.
+	*/
+	void cyclic_share(pwn::shared_cyclic &sequence) {
+		if (sequence.get_width() != cyclic_context.get_width() || sequence.get_alphabet() != cyclic_context.get_alphabet())
+			cyclic_context = pwn::cyclic(sequence.get_width(), sequence.get_alphabet());
+
+		shared = &sequence;
+		owner = sequence.attach();
+		walks = 0;
+	}
+
+	/* the owner id of this context in its shared sequence */
+	std::size_t cyclic_owner() const {
+		if (!shared)
+			throw std::runtime_error("Context does not share its cyclic sequence");
+
+		return owner;
+	}
+
 	std::string cyclic(std::size_t amount) {
-		std::string seq = cyclic_context.get_sequence(amount);
-		cyclic_context.walk(amount);
-		
+		std::uint64_t pos = cyclic_claim(amount);
+		std::string seq(amount, '\0');
+		cyclic_context.fill(pos, seq.data(), amount);
+
 		return seq;
 	}
 
+	/* walks amount characters like cyclic(amount) but hands them out in chunks, see pwn::cyclic_stream */
+	pwn::cyclic_stream cyclic_stream(std::size_t amount) {
+		return pwn::cyclic_stream(cyclic_context, cyclic_claim(amount), amount);
+	}
+
 	std::uint64_t cyclic_find(std::string pattern) {
+		if (shared)
+			return shared->find(pattern).relative;
+
 		return cyclic_context.inverse(pattern);
 	}
+
+	std::vector<cyclic_fragment> cyclic_scan(std::string_view buffer) {
+		if (shared)
+			return shared->scan(buffer);
+
+		return cyclic_context.scan(buffer);
+	}
 };
 
-}
\ No newline at end of file
+}
@@ -1,8 +1,13 @@
 #pragma once
 #include <vector>
 #include <string>
-#include <cmath>
+#include <string_view>
+#include <cstdint>
 #include <algorithm>
+#include <stdexcept>
+
+#include "byteset.hpp"
+#include "format.hpp"
 
 namespace pwn {
 
@@ -10,7 +15,7 @@ namespace detail {
 	template<typename T>
 	std::vector<T> between(std::vector<T> vec, std::size_t pos0, std::size_t pos1) {
 		std::vector<T> new_vec(pos1 - pos0);
-		
+
 		for (std::size_t i = pos0; i < pos1; i++) {
 			new_vec.push_back(vec[i]);
 		}
@@ -21,104 +26,638 @@ namespace detail {
 	std::size_t roundup(std::size_t number, std::size_t multiple) {
 		return ((number + multiple - 1) / multiple) * multiple;
 	}
-}
 
-class cyclic {
-private:
-	std::size_t width;
-	std::vector<std::size_t> history;
-public:
-	cyclic(std::size_t width) : width(width), history({0}) {}
+	/* same default alphabet as pwntools */
+	constexpr std::string_view cyclic_alphabet = "abcdefghijklmnopqrstuvwxyz";
 
-	std::string get(std::size_t pos) {
-		std::string pattern("");
+	/*
+		The lexicographically least de Bruijn sequence of order n over k symbols, the same sequence pwntools generates.
+		It is the concatenation of the Lyndon roots of all necklaces of length n in lexicographic order
+		(Fredricksen, Kessler, Maiorana), e.g. k = 2, n = 3: 0 001 011 1.
+
+		Nothing is ever materialized, positions are located and windows decoded by counting:
+		rank(v) is the length of the prefix of the sequence made up of the necklaces <= v, which equals the number
+		of words of length n with a rotation <= v, i.e. k^n minus the words whose every rotation is > v.
+		A word has every rotation > v exactly when its infinite repetition avoids the patterns v[0..j)c (c < v[j])
+		and v itself, those are counted as the closed walks of length n in the KMP automaton of v.
+		Costs O(n * k + n^4) per rank, independent of the position.
+	*/
+	class de_bruijn {
+	private:
+		std::size_t n;
+		std::size_t k;
+		std::uint64_t total;
 
-		pattern += 'A' + pos % 26;
-		std::size_t num = pos / 26;
-		for (std::size_t i = 1; i < width; i++) {
-			pattern += 'a' + num % 26;
-			num /= 26;
+		/* generator state: the current prenecklace a[1..n] with period p, the next root symbol and position */
+		std::vector<std::uint8_t> a;
+		std::size_t p;
+		std::size_t next_symbol;
+		std::uint64_t position;
+
+		/* scratch space for rank, kept around so locating a position does not allocate */
+		mutable std::vector<std::size_t> fail;
+		mutable std::vector<std::size_t> transition;
+		mutable std::vector<std::uint64_t> matrix, power, product;
+
+		void multiply(std::vector<std::uint64_t> &out, const std::vector<std::uint64_t> &x, const std::vector<std::uint64_t> &y) const {
+			std::fill(product.begin(), product.end(), 0);
+
+			for (std::size_t i = 0; i < n; i++)
+				for (std::size_t l = 0; l < n; l++)
+					if (x[i * n + l])
+						for (std::size_t j = 0; j < n; j++)
+							product[i * n + j] += x[i * n + l] * y[l * n + j];
+
+			out.swap(product);
 		}
 
-		return pattern;
-	}
+		/* trace(matrix^n) by repeated squaring, destroys matrix */
+		std::uint64_t trace_of_power() const {
+			std::fill(power.begin(), power.end(), 0);
+			for (std::size_t i = 0; i < n; i++)
+				power[i * n + i] = 1;
 
-	std::string get_sequence(std::size_t len) {
-		std::string seq("");
-		for (std::size_t i = 0; i < len/width + 1; i++) {
-			seq += get(get_pos()/width + i);
+			for (std::size_t e = n; e; e >>= 1) {
+				if (e & 1)
+					multiply(power, power, matrix);
+				if (e > 1)
+					multiply(matrix, matrix, matrix);
+			}
+
+			std::uint64_t trace = 0;
+			for (std::size_t i = 0; i < n; i++)
+				trace += power[i * n + i];
+
+			return trace;
+		}
+
+		void to_digits(std::uint64_t number, std::uint8_t *out) const {
+			for (std::size_t i = n; i-- > 0;) {
+				out[i] = number % k;
+				number /= k;
+			}
 		}
 
-		seq.erase(len);
+		/* the next prenecklace in lexicographic order, false after the last one */
+		bool next_prenecklace(std::uint8_t *word, std::size_t &period) const {
+			std::size_t t = n;
 
-		return seq;
-	}
+			while (t > 0 && word[t] == k - 1)
+				t--;
 
-	// courtesy of Gabriel Ericson
-	std::uint64_t inverse(std::string pattern) {
-		std::size_t offset = 0;
+			if (t == 0)
+				return false;
 
-		// find the anchor uppercase letter to adjust for the offset
-		for (std::size_t i = 0; i < width; i++) {
-			if (pattern[i] < 'a') {
-				offset = i;
-				break;
+			word[t]++;
+			for (std::size_t i = t + 1; i <= n; i++)
+				word[i] = word[i - t];
+
+			period = t;
+			return true;
+		}
+
+		bool next_necklace(std::uint8_t *word, std::size_t &period) const {
+			do {
+				if (!next_prenecklace(word, period))
+					return false;
+			} while (n % period);
+
+			return true;
+		}
+
+	public:
+		de_bruijn() {}
+		de_bruijn(std::size_t n, std::size_t k):
+			n(n), k(k), total(1), a(n + 1, 0), p(1), next_symbol(1), position(0),
+			fail(n), transition(n * k), matrix(n * n), power(n * n), product(n * n)
+		{
+			if (n == 0 || k < 2 || k > 256)
+				throw std::runtime_error("cyclic patterns need an order > 0 and an alphabet of 2 to 256 symbols");
+
+			for (std::size_t i = 0; i < n; i++) {
+				if (total > UINT64_MAX / k)
+					throw std::runtime_error("cyclic pattern is too long to be indexed with 64 bits");
+				total *= k;
+			}
+		}
+
+		std::uint64_t length() const {
+			return total;
+		}
+
+		std::uint64_t tell() const {
+			return position;
+		}
+
+		/* period of word[0..n) if it is a necklace, 0 otherwise */
+		std::size_t necklace_period(const std::uint8_t *word) const {
+			std::size_t period = 1;
+
+			for (std::size_t i = 1; i < n; i++) {
+				if (word[i] < word[i - period])
+					return 0;
+				if (word[i] > word[i - period])
+					period = i + 1;
+			}
+
+			return n % period ? 0 : period;
+		}
+
+		std::uint64_t rank(const std::uint8_t *v) const {
+			fail[0] = 0;
+			if (n > 1)
+				fail[1] = 0;
+
+			for (std::size_t j = 2; j < n; j++) {
+				std::size_t f = fail[j - 1];
+				while (f && v[f] != v[j - 1])
+					f = fail[f];
+				fail[j] = v[f] == v[j - 1] ? f + 1 : 0;
 			}
+
+			/* transition[j * k + c] is the automaton transition, n marks a dead state */
+			std::fill(matrix.begin(), matrix.end(), 0);
+
+			for (std::size_t j = 0; j < n; j++) {
+				for (std::size_t c = 0; c < k; c++) {
+					std::size_t to;
+
+					if (c < v[j])
+						to = n;
+					else if (c == v[j])
+						to = j + 1;
+					else
+						to = j ? transition[fail[j] * k + c] : 0;
+
+					/* a shorter border may still be followed by a pattern */
+					if (j && c >= v[j] && transition[fail[j] * k + c] == n)
+						to = n;
+
+					transition[j * k + c] = to;
+
+					if (to != n)
+						matrix[j * n + to]++;
+				}
+			}
+
+			return total - trace_of_power();
+		}
+
+		/* continue generating at pos */
+		void seek(std::uint64_t pos) {
+			if (pos > total)
+				throw std::runtime_error("position is past the end of the cyclic pattern");
+
+			if (pos == total) {
+				position = pos;
+				return;
+			}
+
+			/* the smallest word v with rank(v) > pos is the necklace whose root holds pos */
+			std::uint64_t lo = 0, hi = total - 1;
+			std::vector<std::uint8_t> v(n);
+
+			while (lo < hi) {
+				std::uint64_t mid = lo + (hi - lo) / 2;
+				to_digits(mid, v.data());
+
+				if (rank(v.data()) > pos)
+					hi = mid;
+				else
+					lo = mid + 1;
+			}
+
+			to_digits(lo, v.data());
+			std::copy(v.begin(), v.end(), a.begin() + 1);
+			p = necklace_period(v.data());
+
+			next_symbol = 1 + (pos - (rank(v.data()) - p));
+			position = pos;
 		}
 
-		std::string part_lo = pattern.substr(0, offset);
-		std::string part_hi = pattern.substr(offset, pattern.length());
+		/* writes the next count symbols mapped through alphabet to out */
+		void fill(char *out, std::size_t count, const char *alphabet) {
+			if (count > total - position)
+				throw std::runtime_error("cyclic pattern exhausted, use a larger alphabet or order");
 
-		std::uint64_t out_lo = 0;
-		std::uint64_t out_hi = 0;
+			for (std::size_t i = 0; i < count; i++) {
+				if (next_symbol > p) {
+					next_necklace(a.data(), p);
+					next_symbol = 1;
+				}
 
-		for (std::size_t i = offset - 1; i > -1; i--) {
-			out_lo = part_lo[i] - 'a' + 26 * out_lo;
+				out[i] = alphabet[a[next_symbol++]];
+			}
+
+			position += count;
 		}
 
-		bool all_a = true;
+		/* moves the generator s symbols before the end of the root of the necklace word */
+		std::uint64_t place(const std::uint8_t *word, std::size_t period, std::size_t s) {
+			std::copy(word, word + n, a.begin() + 1);
+			p = period;
+			next_symbol = period - s + 1;
+			position = rank(word) - s;
+
+			return position;
+		}
 
 		/*
-			offset 0: [a + 26b + 26²c + 26³d]
-			offset 1: [26b + 26²c + 26³d, (a+1)]
-			offset 2: [26²c + 26³d, a + 26b + 1]
-			offset 3: [26³d, a + 26b + 26²c + 1]
+			position of the window w[0..n), length() if it does not occur.
+			The generator is left at the returned position so the sequence can be continued from the window.
 		*/
+		std::uint64_t find(const std::uint8_t *w) {
+			std::vector<std::uint64_t> unverified;
+			std::vector<std::uint8_t> word(n), successor(n + 1);
+
+			/* true when the necklace after word[0..n) starts with w[s..n) */
+			auto followed_by_tail = [&](std::size_t s) {
+				std::copy(word.begin(), word.end(), successor.begin() + 1);
+
+				std::size_t period;
+				return next_necklace(successor.data(), period) && std::equal(w + s, w + n, successor.begin() + 1);
+			};
 
-		for (std::size_t i = 0; i < part_hi.length(); i++) {
-			if (std::tolower(part_hi[i]) != 'a') {
-				all_a = false;
-				break;
+			/* the sequence ends in the maximal symbol repeated n times, its root is a single symbol */
+			if (std::all_of(w, w + n, [this](std::uint8_t c) { return c == k - 1; })) {
+				seek(total - n);
+				return total - n;
 			}
+
+			/* any other necklace starts at its own root */
+			if (std::size_t period = necklace_period(w))
+				return place(w, period, period);
+
+			/*
+				otherwise w = x y where x ends the root of some necklace and y starts the next one, either
+				y x is that previous necklace or x is all maximal symbols and y starts the first necklace >= y 0..0
+			*/
+			for (std::size_t s = 1; s < n; s++) {
+				std::copy(w + s, w + n, word.begin());
+				std::copy(w, w + s, word.begin() + (n - s));
+
+				std::size_t period = necklace_period(word.data());
+				if (period > s && followed_by_tail(s))
+					return place(word.data(), period, s);
+
+				if (!std::all_of(w, w + s, [this](std::uint8_t c) { return c == k - 1; }))
+					continue;
+
+				/* predecessor of y 0..0 */
+				std::fill(word.begin() + (n - s), word.end(), 0);
+
+				std::size_t i = n;
+				while (i > 0 && word[i - 1] == 0)
+					word[--i] = k - 1;
+
+				if (i == 0)
+					continue;
+
+				word[i - 1]--;
+
+				/* if the predecessor is a necklace it is the one right before y and known to end in x */
+				period = necklace_period(word.data());
+				if (period > s) {
+					if (followed_by_tail(s))
+						return place(word.data(), period, s);
+				}
+				else {
+					unverified.push_back(rank(word.data()) - s);
+				}
+			}
+
+			/* regenerate the window at the remaining candidates, only one of them can match */
+			std::vector<char> window(n);
+			std::vector<char> identity(k);
+			for (std::size_t c = 0; c < k; c++)
+				identity[c] = c;
+
+			for (std::uint64_t candidate : unverified) {
+				if (candidate > total - n)
+					continue;
+
+				seek(candidate);
+				fill(window.data(), n, identity.data());
+
+				if (std::equal(window.begin(), window.end(), w, [](char x, std::uint8_t y) { return static_cast<std::uint8_t>(x) == y; })) {
+					seek(candidate);
+					return candidate;
+				}
+			}
+
+			return total;
+		}
+	};
+
+	/*
+		Approximate set of the windows (as base k numbers) starting in a walked prefix of the sequence, so a scan can
+		reject nearly every window of unrelated text before paying for a rank. A Bloom filter blocked into 64 bit words:
+		a window sets four bits in each of two words and the second word is only read once the first one matched,
+		so rejecting a window costs a single memory access. With 64 bits per window about one lookup in 10^7 is
+		a false positive, which then costs the decode it was meant to save.
+	*/
+	class window_filter {
+	private:
+		static constexpr std::size_t bits_per_window = 64;
+		static constexpr std::size_t min_bits = std::size_t(1) << 16;
+		static constexpr std::size_t max_bits = std::size_t(1) << 28;
+
+		std::vector<std::uint64_t> words;
+		std::uint64_t mask = 0;
+		std::uint64_t covered = 0;
+
+		static std::uint64_t mix(std::uint64_t value) {
+			value *= 0x9e3779b97f4a7c15;
+			return value ^ (value >> 29);
+		}
+
+		/* the four bits of a word that stand for hash */
+		static std::uint64_t pattern(std::uint64_t hash) {
+			return (std::uint64_t(1) << (hash & 63)) | (std::uint64_t(1) << ((hash >> 6) & 63)) |
+				(std::uint64_t(1) << ((hash >> 12) & 63)) | (std::uint64_t(1) << ((hash >> 18) & 63));
 		}
 
-		if (offset && all_a) {
-			out_lo++;
+		void insert(std::uint64_t value) {
+			std::uint64_t first = mix(value);
+			std::uint64_t second = mix(first);
+
+			words[(first >> 32) & mask] |= pattern(first);
+			words[(second >> 32) & mask] |= pattern(second);
 		}
+	public:
+		bool contains(std::uint64_t value) const {
+			std::uint64_t first = mix(value);
+			std::uint64_t bits = pattern(first);
+			if ((words[(first >> 32) & mask] & bits) != bits)
+				return false;
 
-		out_lo *= std::pow(26, width - offset);
-		
-		for (std::size_t i = width - offset - 1; i > 0; i--) {
-			out_hi = part_hi[i] - 'a' + 26 * out_hi;
+			std::uint64_t second = mix(first);
+			bits = pattern(second);
+			return (words[(second >> 32) & mask] & bits) == bits;
 		}
 
-		out_hi = part_hi[0] - 'A' + 26 * out_hi;
+		/* makes sure every window starting below walked is in the set, walked only ever grows */
+		void cover(de_bruijn &sequence, std::size_t n, std::size_t k, std::uint64_t walked) {
+			std::uint64_t windows = walked >= n ? walked - n + 1 : 0;
+			if (windows <= covered && !words.empty())
+				return;
+
+			std::size_t wanted = min_bits;
+			while (wanted < max_bits && wanted / bits_per_window < windows)
+				wanted <<= 1;
+
+			/* growing rehashes everything from the start, which doubling keeps linear overall */
+			std::uint64_t from = covered;
+			if (wanted > words.size() * 64) {
+				words.assign(wanted / 64, 0);
+				mask = wanted / 64 - 1;
+				from = 0;
+			}
+
+			if (windows <= from) {
+				covered = windows;
+				return;
+			}
+
+			std::uint64_t high = 1;
+			for (std::size_t i = 1; i < n; i++)
+				high *= k;
+
+			std::vector<char> identity(k);
+			for (std::size_t c = 0; c < k; c++)
+				identity[c] = c;
+
+			char symbols[4096];
+			std::uint64_t value = 0;
+			std::uint64_t left = windows - from + n - 1;
+			std::size_t held = 0;
 
-		std::uint64_t out = out_lo + out_hi;
-		std::uint64_t pos = (out * width - offset);
+			sequence.seek(from);
 
-		std::size_t i = 0;
-		bool found = false;
-		for (; i < history.size() - 1; i++) {
-			if (pos >= history[i] && pos <= history[i + 1]) {
-				found = true;
-				break;
+			while (left) {
+				std::size_t chunk = std::min<std::uint64_t>(sizeof(symbols), left);
+				sequence.fill(symbols, chunk, identity.data());
+				left -= chunk;
+
+				for (std::size_t i = 0; i < chunk; i++) {
+					value = (value % high) * k + static_cast<std::uint8_t>(symbols[i]);
+
+					if (held < n - 1)
+						held++;
+					else
+						insert(value);
+				}
 			}
+
+			covered = windows;
+		}
+	};
+}
+
+/*
+	A piece of cyclic data found in a scanned buffer.
+*/
+struct cyclic_fragment {
+	std::size_t offset;     // where the fragment starts in the buffer
+	std::size_t length;
+	std::uint64_t position; // absolute position in the sequence
+	std::uint64_t relative; // position relative to its walked range, what cyclic_find returns
+	std::size_t walk;       // index of the walked range, i.e. which call to context::cyclic generated it
+	std::size_t owner = 0;  // context which walked the range when it is shared, see pwn::shared_cyclic
+};
+
+/*
+	A walked range [begin, end) of the sequence, as known to whoever handed it out.
+*/
+struct cyclic_range {
+	std::uint64_t begin;
+	std::uint64_t end;
+	std::size_t walk;
+	std::size_t owner = 0;
+};
+
+class cyclic {
+private:
+	std::size_t width;
+	std::string alphabet;
+	std::int16_t symbol_index[256];
+	detail::byte_set alphabet_set;
+	detail::de_bruijn sequence;
+	detail::window_filter walked_windows;
+	std::vector<std::size_t> history;
+
+	/* position of the first width characters of pattern, get_length() if they are not part of the sequence */
+	std::uint64_t locate(const char *pattern) {
+		std::uint8_t window[64];
+
+		for (std::size_t i = 0; i < width; i++) {
+			std::int16_t symbol = symbol_index[static_cast<std::uint8_t>(pattern[i])];
+
+			if (symbol == -1)
+				return sequence.length();
+
+			window[i] = symbol;
+		}
+
+		return sequence.find(window);
+	}
+public:
+	/*
+		width is the order of the de Bruijn sequence, any width consecutive characters are unique.
+		The default alphabet generates the same pattern as pwntools cyclic(n=width).
+	*/
+	cyclic(std::size_t width, std::string_view alphabet = detail::cyclic_alphabet):
+		width(width ? width : 4),
+		alphabet(alphabet),
+		alphabet_set(alphabet),
+		sequence(this->width, alphabet.length()),
+		history({0})
+	{
+		std::fill(symbol_index, symbol_index + 256, -1);
+
+		for (std::size_t i = 0; i < alphabet.length(); i++) {
+			if (symbol_index[static_cast<std::uint8_t>(alphabet[i])] != -1)
+				throw std::runtime_error(pwn::format("Character {} appears twice in the cyclic alphabet", std::string(1, alphabet[i])));
+
+			symbol_index[static_cast<std::uint8_t>(alphabet[i])] = i;
 		}
+	}
+
+	/* writes the len characters starting at absolute position pos to out, consecutive calls continue without seeking */
+	void fill(std::uint64_t pos, char *out, std::size_t len) {
+		if (sequence.tell() != pos)
+			sequence.seek(pos);
+
+		sequence.fill(out, len, alphabet.data());
+	}
+
+	/* the width characters at absolute position pos */
+	std::string get(std::size_t pos) {
+		std::string pattern(width, '\0');
+		fill(pos, pattern.data(), width);
+
+		return pattern;
+	}
+
+	std::string get_sequence(std::size_t len) {
+		std::string seq(len, '\0');
+		fill(get_pos(), seq.data(), len);
+
+		return seq;
+	}
+
+	/* absolute position of the first width characters of pattern in the sequence */
+	std::uint64_t find(std::string_view pattern) {
+		if (pattern.length() < width)
+			throw std::runtime_error(pwn::format("Cyclic patterns need at least {} characters to be found", width));
+
+		std::uint64_t pos = locate(pattern.data());
+		if (pos == sequence.length())
+			throw std::runtime_error("Pattern is not part of the cyclic sequence");
+
+		return pos;
+	}
+
+	/*
+		position of pattern relative to the start of the walked range it was generated in
+	*/
+	std::uint64_t inverse(std::string_view pattern) {
+		std::uint64_t pos = find(pattern);
+
+		auto range = std::upper_bound(history.begin(), history.end(), pos) - 1;
+		return pos - *range;
+	}
+
+	/*
+		Finds every fragment of cyclic data in buffer which lies in a range handed out by lookup(pos, range),
+		lookup returns false for positions that were never walked and every walked position is below walked.
+		Maximal runs of alphabet characters are found vectorized, the windows of a run are then checked against
+		the set of walked windows while rolling over it, and only those in the set are decoded and followed until
+		they stop following the sequence or cross from one walked range into the next.
+	*/
+	template<typename Lookup>
+	std::vector<cyclic_fragment> scan(std::string_view buffer, std::uint64_t walked, Lookup &&lookup) {
+		std::vector<cyclic_fragment> fragments;
+		char expected[256];
+
+		std::size_t k = alphabet.length();
+		walked_windows.cover(sequence, width, k, std::min(walked, sequence.length()));
+
+		std::uint64_t high = 1;
+		for (std::size_t j = 1; j < width; j++)
+			high *= k;
+
+		auto symbol = [&](std::size_t offset) -> std::uint64_t {
+			return symbol_index[static_cast<std::uint8_t>(buffer[offset])];
+		};
+
+		alphabet_set.for_each_run(buffer, width, [&](std::size_t begin, std::size_t end) {
+			std::size_t i = begin;
+			std::uint64_t value = 0;
+			bool rolling = false;
+
+			while (end - i >= width) {
+				if (rolling) {
+					value = (value - symbol(i - 1) * high) * k + symbol(i + width - 1);
+				}
+				else {
+					value = 0;
+					for (std::size_t j = 0; j < width; j++)
+						value = value * k + symbol(i + j);
+					rolling = true;
+				}
+
+				if (!walked_windows.contains(value)) {
+					i++;
+					continue;
+				}
+
+				std::uint64_t pos = locate(buffer.data() + i);
+				cyclic_range range;
+
+				if (pos == sequence.length() || !lookup(pos, range) || pos + width > range.end) {
+					i++;
+					continue;
+				}
+
+				std::uint64_t limit = std::min<std::uint64_t>(end - i, range.end - pos);
+
+				/* locate leaves the sequence generator at pos, but lookup may have used it */
+				if (sequence.tell() != pos)
+					sequence.seek(pos);
 
-		if (!found)
-			i = history.size() - 1;
-		return pos - history[i];
+				std::size_t length = 0;
+				while (length < limit) {
+					std::size_t chunk = std::min<std::uint64_t>(sizeof(expected), limit - length);
+					sequence.fill(expected, chunk, alphabet.data());
+
+					std::size_t same = std::mismatch(expected, expected + chunk, buffer.data() + i + length).first - expected;
+					length += same;
+
+					if (same < chunk)
+						break;
+				}
+
+				fragments.push_back({i, length, pos, pos - range.begin, range.walk, range.owner});
+				i += length;
+				rolling = false;
+			}
+		});
+
+		return fragments;
+	}
+
+	/* finds every fragment of data walked by this cyclic in buffer, e.g. a core file or a dump of the stack */
+	std::vector<cyclic_fragment> scan(std::string_view buffer) {
+		return scan(buffer, get_pos(), [this](std::uint64_t pos, cyclic_range &range) {
+			if (pos >= get_pos())
+				return false;
+
+			auto itr = std::upper_bound(history.begin(), history.end(), pos) - 1;
+			range = {*itr, *(itr + 1), static_cast<std::size_t>(itr - history.begin())};
+
+			return true;
+		});
 	}
 
 	/*
@@ -127,16 +666,53 @@ public:
 		to generate a relative position.
 	*/
 	void walk(std::size_t number) {
-		history.push_back(detail::roundup(history[history.size() - 1] + number, get_width()));
+		history.push_back(history[history.size() - 1] + number);
 	}
 
 	std::size_t get_width() const {
 		return width;
 	}
 
+	const std::string &get_alphabet() const {
+		return alphabet;
+	}
+
 	std::size_t get_pos() const {
 		return history[history.size() - 1];
 	}
+
+	std::uint64_t get_length() const {
+		return sequence.length();
+	}
+};
+
+/*
+	Reads one range of the sequence in caller sized chunks so long patterns never have to be held in memory.
+
+	char chunk[4096];
+	for (std::size_t n; (n = stream.read(chunk, sizeof(chunk)));)
+		consume(chunk, n);
+*/
+class cyclic_stream {
+private:
+	pwn::cyclic &source;
+	std::uint64_t pos;
+	std::uint64_t end;
+public:
+	cyclic_stream(pwn::cyclic &source, std::uint64_t begin, std::uint64_t length): source(source), pos(begin), end(begin + length) {}
+
+	/* fills out with up to len characters, returns how many were written, 0 once the range is exhausted */
+	std::size_t read(char *out, std::size_t len) {
+		len = std::min<std::uint64_t>(len, end - pos);
+		source.fill(pos, out, len);
+		pos += len;
+
+		return len;
+	}
+
+	std::uint64_t remaining() const {
+		return end - pos;
+	}
 };
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,253 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <cxxabi.h>
+
+#include "basic.hpp"
+
+namespace pwn {
+
+namespace detail {
+	/*
+		Demangles identifier into out, reusing buffer between calls (__cxa_demangle reallocs it as needed).
+		Returns false if identifier is not a mangled name.
+	*/
+	inline bool demangle_into(const char *identifier, char *&buffer, std::size_t &capacity, std::string &out) {
+		int status = 0;
+		std::size_t length = capacity;
+		char *demangled = abi::__cxa_demangle(identifier, buffer, &length, &status);
+
+		switch (status) {
+			case -2:
+				return false;
+			case -1:
+				throw std::runtime_error(pwn::format("memory error occured during demangling of {}", identifier));
+			default:
+				throw std::runtime_error(pwn::format("Unknown error when demangling {}", identifier));
+			case 0:
+				break;
+		}
+
+		buffer = demangled;
+		capacity = std::max(capacity, length);
+
+		out.clear();
+
+		/* drop spaces following template brackets, "a<b<int> >" -> "a<b<int>>" */
+		for (const char *c = demangled; *c; c++) {
+			if ((*c == ' ') && (c > demangled) && ((c[-1] == '<') || (c[-1] == '>')))
+				continue;
+
+			out += *c;
+		}
+
+		return true;
+	}
+
+	/*
+		Append only string storage, strings never move once stored so views into it stay valid.
+	*/
+	class string_arena {
+	private:
+		static constexpr std::size_t block_size = 1 << 16;
+
+		std::vector<std::unique_ptr<char[]>> blocks;
+		std::size_t used = block_size;
+	public:
+		std::string_view store(std::string_view s) {
+			if (s.length() > block_size) {
+				std::unique_ptr<char[]> block(new char[s.length()]);
+				std::memcpy(block.get(), s.data(), s.length());
+
+				std::string_view stored(block.get(), s.length());
+
+				/* the block being filled has to stay last */
+				blocks.insert(blocks.begin(), std::move(block));
+				return stored;
+			}
+
+			if (used + s.length() > block_size) {
+				blocks.emplace_back(new char[block_size]);
+				used = 0;
+			}
+
+			char *dst = blocks.back().get() + used;
+			std::memcpy(dst, s.data(), s.length());
+			used += s.length();
+
+			return std::string_view(dst, s.length());
+		}
+	};
+
+	/*
+		Process wide cache of demangled names shared by every caller and elf object.
+	*/
+	class demangle_cache {
+	private:
+		std::shared_mutex mutex;
+		string_arena arena;
+		std::unordered_map<std::string_view, std::string_view> names;
+	public:
+		bool find(std::string_view mangled, std::string_view &demangled) {
+			std::shared_lock lock(mutex);
+
+			auto itr = names.find(mangled);
+			if (itr == names.end())
+				return false;
+
+			demangled = itr->second;
+			return true;
+		}
+
+		std::string_view insert(std::string_view mangled, std::string_view demangled) {
+			std::unique_lock lock(mutex);
+
+			auto itr = names.find(mangled);
+			if (itr != names.end())
+				return itr->second;
+
+			std::string_view key = arena.store(mangled);
+			std::string_view value = demangled == mangled ? key : arena.store(demangled);
+			names.emplace(key, value);
+
+			return value;
+		}
+
+		static demangle_cache &get() {
+			static demangle_cache cache;
+			return cache;
+		}
+	};
+}
+
+std::string demanglecpp(std::string identifier) {
+	char *buffer = nullptr;
+	std::size_t capacity = 0;
+	std::string s;
+
+	try {
+		if (!detail::demangle_into(identifier.c_str(), buffer, capacity, s))
+			s = identifier;
+	}
+	catch (...) {
+		free(buffer);
+		throw;
+	}
+
+	free(buffer);
+
+	return s;
+}
+
+namespace detail {
+	template<typename T>
+	const std::string &demangle_name(const T &item) {
+		if constexpr (std::is_convertible<const T &, const std::string &>::value)
+			return item;
+		else
+			return item.name;
+	}
+}
+
+/*
+	Demangles a whole symbol table, either a container of strings or of symbols such as
+	elf::get_symbols(). Names which are not mangled are returned as is.
+	Identical names are only demangled once, results are cached for the lifetime of the process
+	and the returned views point into that cache. Names missing from the cache are split over
+	threads (std::thread::hardware_concurrency() when 0) if there are enough of them.
+*/
+template<typename Container, typename = typename std::enable_if<not std::is_convertible<const Container &, std::string>::value>::type>
+std::vector<std::string_view> demanglecpp(const Container &identifiers, std::size_t threads = 0) {
+	constexpr std::size_t names_per_thread = 2048;
+
+	detail::demangle_cache &cache = detail::demangle_cache::get();
+
+	std::vector<std::string_view> result(identifiers.size());
+	std::vector<const std::string *> missing;
+	std::vector<std::pair<std::size_t, std::size_t>> pending;
+	std::unordered_map<std::string_view, std::size_t> unique;
+
+	std::size_t i = 0;
+	for (auto &item : identifiers) {
+		const std::string &identifier = detail::demangle_name(item);
+
+		if (!cache.find(identifier, result[i])) {
+			auto inserted = unique.emplace(identifier, missing.size());
+			if (inserted.second)
+				missing.push_back(&identifier);
+
+			pending.emplace_back(i, inserted.first->second);
+		}
+
+		i++;
+	}
+
+	if (missing.empty())
+		return result;
+
+	std::vector<std::string> demangled(missing.size());
+	std::atomic<std::size_t> next(0);
+	std::exception_ptr error;
+	std::mutex error_mutex;
+
+	auto worker = [&]() {
+		char *buffer = nullptr;
+		std::size_t capacity = 0;
+
+		try {
+			for (std::size_t j; (j = next.fetch_add(1, std::memory_order_relaxed)) < missing.size();) {
+				if (!detail::demangle_into(missing[j]->c_str(), buffer, capacity, demangled[j]))
+					demangled[j] = *missing[j];
+			}
+		}
+		catch (...) {
+			std::lock_guard lock(error_mutex);
+			error = std::current_exception();
+			next = missing.size();
+		}
+
+		free(buffer);
+	};
+
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	threads = std::min(threads, (missing.size() + names_per_thread - 1) / names_per_thread);
+
+	std::vector<std::thread> pool;
+	for (std::size_t t = 1; t < threads; t++)
+		pool.emplace_back(worker);
+
+	worker();
+
+	for (auto &thread : pool)
+		thread.join();
+
+	if (error)
+		std::rethrow_exception(error);
+
+	std::vector<std::string_view> stored(missing.size());
+	for (std::size_t j = 0; j < missing.size(); j++)
+		stored[j] = cache.insert(*missing[j], demangled[j]);
+
+	for (auto &entry : pending)
+		result[entry.first] = stored[entry.second];
+
+	return result;
+}
+
+}
@@ -0,0 +1,362 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace pwn {
+
+namespace detail {
+
+/*
+	A replacement field is either {} or {:[#][0][width][type]} where type is one of
+		x, X: hexadecimal (lower/upper case)
+		p:    hexadecimal prefixed with 0x
+		d:    decimal
+	# prefixes hexadecimal output with 0x and 0 pads up to width with zeroes instead of spaces.
+	A backslash makes the next character literal, so \{} is printed as {}.
+*/
+struct format_spec {
+	char type = '\0';
+	bool alternate = false;
+	bool zero_pad = false;
+	std::size_t width = 0;
+};
+
+struct format_field {
+	std::size_t literal_begin = 0;
+	std::size_t literal_end = 0;
+	bool literal_escaped = false;
+	format_spec spec;
+};
+
+/*
+	fields[i] holds the literal preceding replacement field i and the spec of that field,
+	fields[count] holds the trailing literal.
+*/
+template<std::size_t N>
+struct parsed_format {
+	std::string_view str;
+	std::array<format_field, N + 1> fields {};
+	std::size_t count = 0;
+	std::size_t literal_length = 0;
+};
+
+template<typename T>
+constexpr bool is_format_string_arg = std::is_convertible<T const &, std::string_view>::value;
+
+template<typename T>
+constexpr bool is_format_hex_arg = not is_format_string_arg<T> and (std::is_integral<T>::value or std::is_pointer<T>::value);
+
+template<std::size_t N>
+constexpr parsed_format<N> parse_format(std::string_view str) {
+	parsed_format<N> parsed {str};
+
+	std::size_t begin = 0;
+	bool escaped = false;
+
+	for (std::size_t i = 0; i < str.length(); i++) {
+		if (str[i] == '\\') {
+			escaped = true;
+			if (++i < str.length())
+				parsed.literal_length++;
+			continue;
+		}
+
+		if ((str[i] != '{') || (i + 1 >= str.length()) || (str[i + 1] != '}' && str[i + 1] != ':')) {
+			parsed.literal_length++;
+			continue;
+		}
+
+		if (parsed.count == N)
+			throw std::runtime_error("format string has more replacement fields than arguments");
+
+		format_field &field = parsed.fields[parsed.count++];
+		field.literal_begin = begin;
+		field.literal_end = i;
+		field.literal_escaped = escaped;
+
+		if (str[++i] == ':') {
+			i++;
+
+			if (i < str.length() && str[i] == '#') {
+				field.spec.alternate = true;
+				i++;
+			}
+
+			if (i < str.length() && str[i] == '0') {
+				field.spec.zero_pad = true;
+				i++;
+			}
+
+			for (; i < str.length() && str[i] >= '0' && str[i] <= '9'; i++)
+				field.spec.width = field.spec.width * 10 + (str[i] - '0');
+
+			if (i < str.length() && str[i] != '}') {
+				if (str[i] != 'x' && str[i] != 'X' && str[i] != 'p' && str[i] != 'd')
+					throw std::runtime_error("format string has an unknown type in a replacement field");
+
+				field.spec.type = str[i++];
+			}
+
+			if (i >= str.length() || str[i] != '}')
+				throw std::runtime_error("format string has an unterminated replacement field");
+		}
+
+		begin = i + 1;
+		escaped = false;
+	}
+
+	format_field &trailing = parsed.fields[parsed.count];
+	trailing.literal_begin = begin;
+	trailing.literal_end = str.length();
+	trailing.literal_escaped = escaped;
+
+	return parsed;
+}
+
+struct runtime_format_string {
+	std::string_view str;
+};
+
+/*
+	The formatted representation of a single argument, numbers are rendered into the
+	inline digits buffer so that formatting does not allocate.
+*/
+struct format_piece {
+	std::string_view prefix;
+	std::string_view body;
+	char digits[2 * sizeof(std::uint64_t) + 1];
+	std::string storage;
+
+	std::size_t length(const format_spec &spec) const {
+		return std::max(spec.width, prefix.length() + body.length());
+	}
+};
+
+template<typename T>
+void make_piece(format_piece &piece, const format_spec &spec, T const &val) {
+	if constexpr (is_format_string_arg<T>) {
+		piece.body = std::string_view(val);
+	}
+	else if constexpr (std::is_pointer<T>::value or std::is_integral<T>::value) {
+		bool hex = spec.type == 'x' || spec.type == 'X' || spec.type == 'p';
+
+		if constexpr (std::is_pointer<T>::value)
+			hex = spec.type != 'd';
+
+		if (hex) {
+			std::uint64_t number;
+
+			if constexpr (std::is_pointer<T>::value)
+				number = reinterpret_cast<std::uintptr_t>(val);
+			else if constexpr (std::is_same<T, bool>::value)
+				number = val;
+			else
+				number = static_cast<typename std::make_unsigned<T>::type>(val);
+
+			auto result = std::to_chars(piece.digits, piece.digits + sizeof(piece.digits), number, 16);
+
+			if (spec.type == 'X') {
+				for (char *c = piece.digits; c < result.ptr; c++)
+					if (*c >= 'a')
+						*c -= 'a' - 'A';
+			}
+
+			if (spec.alternate || spec.type == 'p' || (std::is_pointer<T>::value && spec.type == '\0'))
+				piece.prefix = "0x";
+
+			piece.body = std::string_view(piece.digits, result.ptr - piece.digits);
+		}
+		else {
+			std::uint64_t number;
+
+			if constexpr (std::is_pointer<T>::value) {
+				number = reinterpret_cast<std::uintptr_t>(val);
+			}
+			else if constexpr (std::is_signed<T>::value) {
+				/* keep the sign in the prefix so zero padding is placed after it */
+				if (val < 0)
+					piece.prefix = "-";
+				number = val < 0 ? -static_cast<std::uint64_t>(val) : val;
+			}
+			else {
+				number = val;
+			}
+
+			auto result = std::to_chars(piece.digits, piece.digits + sizeof(piece.digits), number);
+			piece.body = std::string_view(piece.digits, result.ptr - piece.digits);
+		}
+	}
+	else {
+		piece.storage = std::to_string(val);
+		piece.body = piece.storage;
+	}
+}
+
+struct format_cursor {
+	char *pos;
+	char *end;
+
+	void put(const char *what, std::size_t n) {
+		n = std::min<std::size_t>(n, end - pos);
+		std::memcpy(pos, what, n);
+		pos += n;
+	}
+
+	void put(std::string_view what) {
+		put(what.data(), what.length());
+	}
+
+	void fill(char c, std::size_t n) {
+		n = std::min<std::size_t>(n, end - pos);
+		std::memset(pos, c, n);
+		pos += n;
+	}
+
+	void put_literal(std::string_view str, const format_field &field) {
+		if (!field.literal_escaped) {
+			put(str.data() + field.literal_begin, field.literal_end - field.literal_begin);
+			return;
+		}
+
+		for (std::size_t i = field.literal_begin; i < field.literal_end; i++) {
+			if (str[i] == '\\' && ++i == field.literal_end)
+				break;
+			put(&str[i], 1);
+		}
+	}
+
+	void put_piece(const format_piece &piece, const format_spec &spec) {
+		std::size_t length = piece.prefix.length() + piece.body.length();
+		std::size_t padding = spec.width > length ? spec.width - length : 0;
+
+		if (spec.zero_pad) {
+			put(piece.prefix);
+			fill('0', padding);
+		}
+		else {
+			fill(' ', padding);
+			put(piece.prefix);
+		}
+
+		put(piece.body);
+	}
+};
+
+/*
+	Every argument is rendered exactly once, the sizes are summed and written in a single pass
+	so the caller can reserve the exact output size up front.
+*/
+template<std::size_t N>
+class formatter {
+private:
+	const parsed_format<N> &parsed;
+	std::array<format_piece, N> pieces;
+public:
+	template<typename ...Args>
+	formatter(const parsed_format<N> &parsed, Args const &...arglist): parsed(parsed) {
+		std::size_t i = 0;
+		((i < parsed.count ? make_piece(pieces[i], parsed.fields[i].spec, arglist) : void(), i++), ...);
+	}
+
+	std::size_t size() const {
+		std::size_t total = parsed.literal_length;
+
+		for (std::size_t i = 0; i < parsed.count; i++)
+			total += pieces[i].length(parsed.fields[i].spec);
+
+		return total;
+	}
+
+	void write(format_cursor &cursor) const {
+		for (std::size_t i = 0; i < parsed.count; i++) {
+			cursor.put_literal(parsed.str, parsed.fields[i]);
+			cursor.put_piece(pieces[i], parsed.fields[i].spec);
+		}
+
+		cursor.put_literal(parsed.str, parsed.fields[parsed.count]);
+	}
+};
+
+}
+
+/*
+	Format strings are parsed when the program is compiled, a malformed format string or a
+	replacement field without a matching argument is a compile error.
+	Format strings only known at runtime can be used through pwn::runtime_format.
+*/
+template<typename ...Args>
+class basic_format_string {
+public:
+	detail::parsed_format<sizeof...(Args)> parsed;
+
+	template<typename T, typename = typename std::enable_if<std::is_convertible<T const &, std::string_view>::value>::type>
+	consteval basic_format_string(T const &str): parsed(detail::parse_format<sizeof...(Args)>(str)) {
+		constexpr bool hexable[] = {detail::is_format_hex_arg<typename std::decay<Args>::type> ..., false};
+
+		for (std::size_t i = 0; i < parsed.count; i++) {
+			const detail::format_spec &spec = parsed.fields[i].spec;
+
+			if ((spec.type != '\0' || spec.alternate) && !hexable[i])
+				throw std::runtime_error("format type given for an argument which is not an integer or a pointer");
+		}
+	}
+
+	basic_format_string(detail::runtime_format_string str): parsed(detail::parse_format<sizeof...(Args)>(str.str)) {}
+};
+
+template<typename ...Args>
+using format_string = basic_format_string<std::type_identity_t<Args> ...>;
+
+inline detail::runtime_format_string runtime_format(std::string_view str) {
+	return detail::runtime_format_string {str};
+}
+
+template<typename ...Args>
+std::size_t formatted_size(format_string<Args ...> fmt, Args const &...arglist) {
+	return detail::formatter<sizeof...(Args)>(fmt.parsed, arglist ...).size();
+}
+
+/*
+	Appends to out with a single allocation.
+*/
+template<typename ...Args>
+void format_to(std::string &out, format_string<Args ...> fmt, Args const &...arglist) {
+	detail::formatter<sizeof...(Args)> formatter(fmt.parsed, arglist ...);
+
+	std::size_t old_length = out.length();
+	out.resize(old_length + formatter.size());
+
+	detail::format_cursor cursor {out.data() + old_length, out.data() + out.length()};
+	formatter.write(cursor);
+}
+
+/*
+	Writes at most size bytes to out without allocating and returns the length of the
+	complete output, like snprintf but without null termination.
+*/
+template<typename ...Args>
+std::size_t format_to(char *out, std::size_t size, format_string<Args ...> fmt, Args const &...arglist) {
+	detail::formatter<sizeof...(Args)> formatter(fmt.parsed, arglist ...);
+
+	detail::format_cursor cursor {out, out + size};
+	formatter.write(cursor);
+
+	return formatter.size();
+}
+
+template<typename ...Args>
+std::string format(format_string<Args ...> fmt, Args const &...arglist) {
+	std::string s;
+	format_to(s, fmt, arglist ...);
+
+	return s;
+}
+
+}
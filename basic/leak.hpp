@@ -0,0 +1,141 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace pwn {
+
+/*
+	A half open address range [begin, end), tag is free for the caller to identify
+	the mapping, e.g. the index of the segment it was created from.
+*/
+struct address_range {
+	std::uint64_t begin;
+	std::uint64_t end;
+	std::size_t tag = 0;
+
+	bool contains(std::uint64_t address) const {
+		return address >= begin && address < end;
+	}
+};
+
+struct leak_hit {
+	std::size_t offset;  // byte offset of the word in the leak
+	std::uint64_t value;
+	std::size_t range;   // index into the ranges the leak was scanned with
+};
+
+namespace detail {
+	inline void classify_word(std::vector<leak_hit> &hits, const std::vector<address_range> &ranges, std::size_t offset, std::uint64_t value) {
+		for (std::size_t r = 0; r < ranges.size(); r++) {
+			if (ranges[r].contains(value)) {
+				hits.push_back({offset, value, r});
+				return;
+			}
+		}
+	}
+
+#if defined(__AVX2__)
+	/*
+		AVX2 only has signed compares, flipping the sign bit of both sides turns them into
+		unsigned compares. Every range is tested against a whole vector of words and only
+		vectors containing a hit fall back to the scalar classification.
+	*/
+	template<typename T>
+	std::size_t scan_leak_avx2(std::vector<leak_hit> &hits, const char *data, std::size_t count, const std::vector<address_range> &ranges) {
+		constexpr std::size_t lanes = sizeof(__m256i) / sizeof(T);
+		constexpr bool is_64bit = sizeof(T) == 8;
+
+		const __m256i bias = is_64bit ? _mm256_set1_epi64x(INT64_MIN) : _mm256_set1_epi32(INT32_MIN);
+		const __m256i ones = _mm256_set1_epi32(-1);
+
+		/* last is inclusive, so a range reaching the top of T (0xffffffff for 32 bit words) still matches it */
+		struct bound {
+			__m256i begin;
+			__m256i last;
+		};
+
+		std::vector<bound> bounds;
+		for (auto &range : ranges) {
+			if (range.end <= range.begin)
+				continue;
+
+			/* ranges which do not fit in T can still match the part of them that does */
+			std::uint64_t begin = range.begin;
+			std::uint64_t last = range.end - 1;
+
+			if constexpr (!is_64bit) {
+				if (begin > UINT32_MAX)
+					continue;
+				last = std::min<std::uint64_t>(last, UINT32_MAX);
+			}
+
+			if constexpr (is_64bit)
+				bounds.push_back({_mm256_xor_si256(_mm256_set1_epi64x(begin), bias), _mm256_xor_si256(_mm256_set1_epi64x(last), bias)});
+			else
+				bounds.push_back({_mm256_xor_si256(_mm256_set1_epi32(begin), bias), _mm256_xor_si256(_mm256_set1_epi32(last), bias)});
+		}
+
+		std::size_t i = 0;
+		for (; i + lanes <= count; i += lanes) {
+			__m256i words = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i * sizeof(T))), bias);
+			__m256i any = _mm256_setzero_si256();
+
+			for (auto &bound : bounds) {
+				__m256i below = is_64bit ? _mm256_cmpgt_epi64(bound.begin, words) : _mm256_cmpgt_epi32(bound.begin, words);
+				__m256i above = is_64bit ? _mm256_cmpgt_epi64(words, bound.last) : _mm256_cmpgt_epi32(words, bound.last);
+				any = _mm256_or_si256(any, _mm256_andnot_si256(_mm256_or_si256(below, above), ones));
+			}
+
+			if (_mm256_testz_si256(any, any))
+				continue;
+
+			for (std::size_t lane = 0; lane < lanes; lane++) {
+				T value;
+				std::memcpy(&value, data + (i + lane) * sizeof(T), sizeof(T));
+				classify_word(hits, ranges, (i + lane) * sizeof(T), value);
+			}
+		}
+
+		return i;
+	}
+#endif
+}
+
+/*
+	Returns every aligned word of the leak which lies inside one of ranges, for instance
+	the segments of a binary rebased to a leaked address (see elf::get_ranges).
+	Words are T sized and little endian, a range index refers to the first matching range.
+*/
+template<typename T = std::uint64_t>
+std::vector<leak_hit> scan_leak(std::string_view leak, const std::vector<address_range> &ranges) {
+	static_assert(std::is_same<T, std::uint64_t>::value || std::is_same<T, std::uint32_t>::value, "scan_leak only supports 32 and 64 bit words");
+
+	std::vector<leak_hit> hits;
+	std::size_t count = leak.length() / sizeof(T);
+	std::size_t i = 0;
+
+	if (ranges.empty())
+		return hits;
+
+#if defined(__AVX2__)
+	i = detail::scan_leak_avx2<T>(hits, leak.data(), count, ranges);
+#endif
+
+	for (; i < count; i++) {
+		T value;
+		std::memcpy(&value, leak.data() + i * sizeof(T), sizeof(T));
+		detail::classify_word(hits, ranges, i * sizeof(T), value);
+	}
+
+	return hits;
+}
+
+}
@@ -0,0 +1,261 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "basic.hpp"
+#include "config.hpp"
+#include "context.hpp"
+
+namespace pwn {
+
+/*
+	Builds a payload in a single contiguous buffer, every append writes in place instead of
+	creating a temporary string like p64 and operator+ would.
+	A payload converts to std::string_view and const std::string & so it can be passed to
+	instance::send without another copy.
+
+	auto rop = pwn::payload(0x1000)
+		.pad_to(40)
+		.p64(pop_rdi)
+		.p64(binsh)
+		.p64(system);
+*/
+class payload {
+private:
+	std::string buffer;
+
+	template<typename T>
+	payload &append_packed(T value, bool big) {
+		std::size_t old_length = buffer.length();
+		buffer.resize(old_length + sizeof(T));
+		detail::pack<T>(buffer.data() + old_length, value, big);
+
+		return *this;
+	}
+public:
+	payload(std::size_t capacity = 256) {
+		buffer.reserve(capacity);
+	}
+
+	payload &p8(std::uint8_t value) { return append_packed<std::uint8_t>(value, false); }
+	payload &p16(std::uint16_t value) { return append_packed<std::uint16_t>(value, false); }
+	payload &p32(std::uint32_t value) { return append_packed<std::uint32_t>(value, false); }
+	payload &p64(std::uint64_t value) { return append_packed<std::uint64_t>(value, false); }
+
+	payload &p16be(std::uint16_t value) { return append_packed<std::uint16_t>(value, true); }
+	payload &p32be(std::uint32_t value) { return append_packed<std::uint32_t>(value, true); }
+	payload &p64be(std::uint64_t value) { return append_packed<std::uint64_t>(value, true); }
+
+	/* pack a word of the given pwn::bit64 / pwn::bit32 width */
+	payload &word(std::uint64_t value, pwnflag width = pwn::bit64) {
+		if (width == pwn::bit32)
+			return p32(value);
+		return p64(value);
+	}
+
+	payload &raw(std::string_view bytes) {
+		buffer.append(bytes.data(), bytes.length());
+		return *this;
+	}
+
+	payload &fill(char c, std::size_t n) {
+		buffer.append(n, c);
+		return *this;
+	}
+
+	/* fill with c until the payload is offset bytes long */
+	payload &pad_to(std::size_t offset, char c = 'A') {
+		if (offset < buffer.length())
+			throw std::runtime_error(pwn::format("Can not pad payload of length {} to offset {}", buffer.length(), offset));
+
+		return fill(c, offset - buffer.length());
+	}
+
+	/* append unique cyclic data from ctx, findable with ctx.cyclic_find */
+	payload &cyclic(pwn::context &ctx, std::size_t n) {
+		pwn::cyclic_stream stream = ctx.cyclic_stream(n);
+		std::size_t old_length = buffer.length();
+		buffer.resize(old_length + n);
+		stream.read(buffer.data() + old_length, n);
+
+		return *this;
+	}
+
+	payload &operator+=(std::string_view bytes) {
+		return raw(bytes);
+	}
+
+	void reserve(std::size_t capacity) {
+		buffer.reserve(capacity);
+	}
+
+	void clear() {
+		buffer.clear();
+	}
+
+	const char *data() const {
+		return buffer.data();
+	}
+
+	std::size_t size() const {
+		return buffer.length();
+	}
+
+	const std::string &str() const {
+		return buffer;
+	}
+
+	operator std::string_view() const {
+		return buffer;
+	}
+
+	operator const std::string &() const {
+		return buffer;
+	}
+};
+
+namespace detail {
+	struct flat_value {
+		std::string_view bytes;
+		char packed[sizeof(std::uint64_t)];
+
+		template<typename T, typename std::enable_if<std::is_integral<T>::value, int>::type = 0>
+		flat_value(T value) {
+			pack<std::uint64_t>(packed, value);
+			bytes = std::string_view(packed, sizeof(packed));
+		}
+
+		flat_value(std::string_view value): bytes(value) {}
+		flat_value(const char *value): bytes(value) {}
+		flat_value(const std::string &value): bytes(value) {}
+
+		flat_value(const flat_value &other): bytes(other.bytes) {
+			std::copy(other.packed, other.packed + sizeof(packed), packed);
+			if (other.bytes.data() == other.packed)
+				bytes = std::string_view(packed, sizeof(packed));
+		}
+	};
+}
+
+/*
+	Lays out values at fixed offsets similar to pwntools flat({offset: value}),
+	integers are packed as 64 bit little endian words (32 bit with pwn::bit32) and the gaps are filled with filler.
+
+	auto p = pwn::flat({{0, "/bin/sh"}, {40, 0x401136}});
+*/
+inline payload flat(std::initializer_list<std::pair<std::size_t, detail::flat_value>> entries, char filler = 'A', pwnflag width = pwn::bit64) {
+	std::vector<std::pair<std::size_t, std::string_view>> layout;
+	layout.reserve(entries.size());
+
+	for (auto &entry : entries) {
+		std::string_view bytes = entry.second.bytes;
+
+		if (bytes.data() == entry.second.packed && width == pwn::bit32)
+			bytes = bytes.substr(0, 4);
+
+		layout.emplace_back(entry.first, bytes);
+	}
+
+	std::sort(layout.begin(), layout.end(), [](auto &a, auto &b) { return a.first < b.first; });
+
+	std::size_t length = layout.empty() ? 0 : layout.back().first + layout.back().second.length();
+	for (std::size_t i = 1; i < layout.size(); i++) {
+		if (layout[i - 1].first + layout[i - 1].second.length() > layout[i].first)
+			throw std::runtime_error(pwn::format("flat: value at offset {} overlaps value at offset {}", layout[i].first, layout[i - 1].first));
+		length = std::max(length, layout[i - 1].first + layout[i - 1].second.length());
+	}
+
+	payload p(length);
+	for (auto &entry : layout)
+		p.pad_to(entry.first, filler).raw(entry.second);
+
+	return p;
+}
+
+/*
+	Fixed size payload which can be built in a constant expression, for ROP chains with a known layout
+	the bytes are then embedded in the binary.
+
+	constexpr auto chain = [] {
+		pwn::static_payload<64> p;
+		p.pad_to(40).p64(0x401136);
+		return p;
+	}();
+*/
+template<std::size_t N>
+class static_payload {
+private:
+	std::array<char, N> buffer {};
+	std::size_t length = 0;
+
+	template<typename T>
+	constexpr static_payload &append_packed(T value, bool big) {
+		if (length + sizeof(T) > N)
+			throw std::runtime_error("static_payload capacity exceeded");
+
+		detail::pack<T>(buffer.data() + length, value, big);
+		length += sizeof(T);
+
+		return *this;
+	}
+public:
+	constexpr static_payload() {}
+
+	constexpr static_payload &p8(std::uint8_t value) { return append_packed<std::uint8_t>(value, false); }
+	constexpr static_payload &p16(std::uint16_t value) { return append_packed<std::uint16_t>(value, false); }
+	constexpr static_payload &p32(std::uint32_t value) { return append_packed<std::uint32_t>(value, false); }
+	constexpr static_payload &p64(std::uint64_t value) { return append_packed<std::uint64_t>(value, false); }
+
+	constexpr static_payload &p16be(std::uint16_t value) { return append_packed<std::uint16_t>(value, true); }
+	constexpr static_payload &p32be(std::uint32_t value) { return append_packed<std::uint32_t>(value, true); }
+	constexpr static_payload &p64be(std::uint64_t value) { return append_packed<std::uint64_t>(value, true); }
+
+	constexpr static_payload &raw(std::string_view bytes) {
+		if (length + bytes.length() > N)
+			throw std::runtime_error("static_payload capacity exceeded");
+
+		for (char c : bytes)
+			buffer[length++] = c;
+
+		return *this;
+	}
+
+	constexpr static_payload &fill(char c, std::size_t n) {
+		if (length + n > N)
+			throw std::runtime_error("static_payload capacity exceeded");
+
+		for (std::size_t i = 0; i < n; i++)
+			buffer[length++] = c;
+
+		return *this;
+	}
+
+	constexpr static_payload &pad_to(std::size_t offset, char c = 'A') {
+		if (offset < length)
+			throw std::runtime_error("static_payload can not pad to an offset before its end");
+
+		return fill(c, offset - length);
+	}
+
+	constexpr const char *data() const {
+		return buffer.data();
+	}
+
+	constexpr std::size_t size() const {
+		return length;
+	}
+
+	constexpr operator std::string_view() const {
+		return std::string_view(buffer.data(), length);
+	}
+};
+
+}
@@ -0,0 +1,215 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+#include "cyclic.hpp"
+#include "format.hpp"
+
+namespace pwn {
+
+/*
+	Where a piece of shared cyclic data came from.
+*/
+struct cyclic_origin {
+	std::uint64_t position; // absolute position in the sequence
+	std::uint64_t relative; // position relative to the walked range, what cyclic_find returns
+	std::size_t walk;       // index of the range among the ranges of its owner
+	std::size_t owner;      // context which walked the range
+};
+
+/*
+	One cyclic sequence shared by any number of contexts (and instances), possibly on different threads,
+	so a pattern found in any crash maps back to the context and walk which sent it.
+
+	Walking never locks: the range is claimed with a fetch-add on the next free position and recorded
+	in a slot claimed the same way. Slots live in fixed blocks which are published with a compare-exchange
+	and never move, so readers can look through them while other threads keep walking.
+	Only find and scan, which decode the sequence, are serialized. They move the slots recorded since into
+	a range index sorted by position, which stays nearly in slot order, and binary search it.
+
+	pwn::shared_cyclic shared(pwn::bit64);
+	pwn::instance<pwn::remote | pwn::bit64> r("127.0.0.1", 1337);
+	r.share_cyclic(shared);
+*/
+class shared_cyclic {
+private:
+	static constexpr std::size_t block_size = 4096;
+	static constexpr std::size_t max_blocks = 4096;
+
+	struct allocation {
+		std::uint64_t begin;
+		std::uint64_t end;
+		std::size_t walk;
+		std::size_t owner;
+		std::atomic<bool> ready {false};
+	};
+
+	std::size_t width;
+	std::uint64_t length;
+	std::atomic<std::uint64_t> next_position {0};
+	std::atomic<std::size_t> next_slot {0};
+	std::atomic<std::size_t> next_owner {0};
+	std::atomic<allocation *> blocks[max_blocks] = {};
+
+	std::mutex decode_mutex;
+	pwn::cyclic decoder;
+
+	/* ranges of the slots before indexed sorted by begin, only touched with decode_mutex held */
+	std::vector<cyclic_range> index;
+	std::size_t indexed = 0;
+
+	allocation &slot(std::size_t index) {
+		std::atomic<allocation *> &block = blocks[index / block_size];
+		allocation *current = block.load(std::memory_order_acquire);
+
+		if (!current) {
+			allocation *fresh = new allocation[block_size];
+
+			if (block.compare_exchange_strong(current, fresh, std::memory_order_acq_rel))
+				current = fresh;
+			else
+				delete[] fresh;
+		}
+
+		return current[index % block_size];
+	}
+
+	allocation *ready_slot(std::size_t i) {
+		allocation *block = blocks[i / block_size].load(std::memory_order_acquire);
+		if (!block || !block[i % block_size].ready.load(std::memory_order_acquire))
+			return nullptr;
+
+		return &block[i % block_size];
+	}
+
+	/* moves every slot up to the first one still being written into the index, returns how many were claimed */
+	std::size_t index_slots() {
+		std::size_t count = std::min(next_slot.load(std::memory_order_acquire), block_size * max_blocks);
+
+		for (; indexed < count; indexed++) {
+			allocation *a = ready_slot(indexed);
+			if (!a)
+				break;
+
+			/* slots are claimed right after their positions, so ranges arrive almost sorted and land near the end */
+			cyclic_range range {a->begin, a->end, a->walk, a->owner};
+			auto at = std::upper_bound(index.begin(), index.end(), range.begin, [](std::uint64_t begin, const cyclic_range &r) {
+				return begin < r.begin;
+			});
+			index.insert(at, range);
+		}
+
+		return count;
+	}
+
+	bool lookup(std::uint64_t pos, cyclic_range &range) {
+		std::size_t count = index_slots();
+
+		auto itr = std::upper_bound(index.begin(), index.end(), pos, [](std::uint64_t p, const cyclic_range &r) {
+			return p < r.begin;
+		});
+
+		if ((itr != index.begin()) && (pos < (itr - 1)->end)) {
+			range = *(itr - 1);
+			return true;
+		}
+
+		/* the few slots behind one which is still being written */
+		for (std::size_t i = indexed; i < count; i++) {
+			allocation *a = ready_slot(i);
+
+			if (a && pos >= a->begin && pos < a->end) {
+				range = {a->begin, a->end, a->walk, a->owner};
+				return true;
+			}
+		}
+
+		return false;
+	}
+public:
+	shared_cyclic(std::size_t width, std::string_view alphabet = detail::cyclic_alphabet):
+		decoder(width, alphabet)
+	{
+		this->width = decoder.get_width();
+		length = decoder.get_length();
+	}
+
+	shared_cyclic(const shared_cyclic &) = delete;
+	shared_cyclic &operator=(const shared_cyclic &) = delete;
+
+	~shared_cyclic() {
+		for (auto &block : blocks)
+			delete[] block.load();
+	}
+
+	/* a new owner id, every context sharing the sequence gets one */
+	std::size_t attach() {
+		return next_owner.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	/*
+		Claims the next amount characters of the sequence for owner, walk is the owner's own count of walks.
+		Returns the absolute position the range starts at.
+	*/
+	std::uint64_t walk(std::size_t owner, std::size_t walk, std::size_t amount) {
+		/* only claims which fit move the position on, so one oversized request leaves the rest to everyone else */
+		std::uint64_t begin = next_position.load(std::memory_order_relaxed);
+		do {
+			if (amount > length - begin)
+				throw std::runtime_error("Shared cyclic pattern exhausted, use a larger alphabet or width");
+		} while (!next_position.compare_exchange_weak(begin, begin + amount, std::memory_order_relaxed));
+
+		/* a slot index is only taken when it exists, readers stop at the first slot which is not ready */
+		std::size_t index = next_slot.load(std::memory_order_relaxed);
+		do {
+			if (index >= block_size * max_blocks)
+				throw std::runtime_error(pwn::format("Shared cyclic pattern can not record more than {} walks", block_size * max_blocks));
+		} while (!next_slot.compare_exchange_weak(index, index + 1, std::memory_order_relaxed));
+
+		allocation &a = slot(index);
+		a.begin = begin;
+		a.end = begin + amount;
+		a.walk = walk;
+		a.owner = owner;
+		a.ready.store(true, std::memory_order_release);
+
+		return begin;
+	}
+
+	/* where the first width characters of pattern were walked */
+	cyclic_origin find(std::string_view pattern) {
+		std::lock_guard lock(decode_mutex);
+
+		std::uint64_t pos = decoder.find(pattern);
+		cyclic_range range;
+
+		if (!lookup(pos, range))
+			throw std::runtime_error("Pattern is part of the cyclic sequence but was never walked");
+
+		return {pos, pos - range.begin, range.walk, range.owner};
+	}
+
+	/* finds every fragment of walked data in buffer, see pwn::cyclic::scan */
+	std::vector<cyclic_fragment> scan(std::string_view buffer) {
+		std::lock_guard lock(decode_mutex);
+
+		return decoder.scan(buffer, next_position.load(std::memory_order_acquire), [this](std::uint64_t pos, cyclic_range &range) {
+			return lookup(pos, range);
+		});
+	}
+
+	std::size_t get_width() const {
+		return width;
+	}
+
+	const std::string &get_alphabet() const {
+		return decoder.get_alphabet();
+	}
+};
+
+}
@@ -0,0 +1,535 @@
+#pragma once
+#include <cppwnlib/basic/config.hpp>
+#include <cppwnlib/basic/format.hpp>
+#include <cppwnlib/elf/elf.hpp>
+#include <cppwnlib/sockets/instance.hpp>
+#include <cppwnlib/sockets/process.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/ptrace.h>
+#include <sys/uio.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace pwn {
+
+/* the general purpose registers of a stopped process */
+using registers = user_regs_struct;
+
+/* why a process under a pwn::debugger stopped */
+struct debug_stop {
+	/* the signal which stopped it, SIGTRAP for breakpoints and steps, 0 if it was interrupted */
+	int signal = 0;
+	/* address of the breakpoint it stopped at, 0 if it was none */
+	std::uintptr_t breakpoint = 0;
+	/* set once the process ended, it can not be continued anymore then */
+	std::optional<pwn::exit_status> exited;
+};
+
+/* an address range in the debugged process */
+struct memory_range {
+	std::uintptr_t address;
+	std::size_t length;
+};
+
+/*
+	A ptrace debugger for the process of a local instance. Processes spawned with spawn_options::traced() are taken
+	over stopped right after execve, any other one (e.g. of a fork_server) is attached to and interrupted.
+	The process is stopped whenever no call of the debugger runs, cont and step return once it stopped again.
+	Memory is moved with process_vm_readv/writev, every batch of ranges costs one syscall per IOV_MAX of them.
+
+	pwn::instance<pwn::local | pwn::bit64> p(pwn::spawn_options().traced(), "./vuln");
+	pwn::elf<pwn::bit64> binary("./vuln");
+	pwn::debugger gdb(p);
+
+	gdb.break_at(binary, "main");
+	gdb.cont();
+	auto words = gdb.read_words(addresses);
+
+	ptrace requests only work from the thread which spawned a traced process or created the debugger,
+	and the debugger must be gone before its instance is. While it exists it is the one to wait for the process.
+*/
+class debugger {
+private:
+	pid_t pid;
+	bool own_child;
+	int pending_signal = 0;
+	std::optional<pwn::exit_status> ended;
+
+	/* original byte under every int3 we placed */
+	std::unordered_map<std::uintptr_t, std::uint8_t> breakpoints;
+
+	static auto &impl_pc(pwn::registers &regs) {
+#if defined(__x86_64__)
+		return regs.rip;
+#elif defined(__i386__)
+		return regs.eip;
+#else
+#error "pwn::debugger supports x86 and x86-64"
+#endif
+	}
+
+	void impl_ptrace(__ptrace_request request, void *address, void *data, std::string_view what) {
+		if (ptrace(request, pid, address, data) < 0)
+			throw std::runtime_error(pwn::format("Could not {} process {}: {}", what, pid, strerror(errno)));
+	}
+
+	void impl_check_stopped() {
+		if (ended)
+			throw std::runtime_error(pwn::format("Process {} already {}", pid, ended->describe()));
+	}
+
+	/*
+		Waits for the next stop or the end of the process. The end of our own child is only peeked at,
+		so its instance can still reap it and learn its status.
+	*/
+	debug_stop impl_wait() {
+		debug_stop stop;
+
+		while (true) {
+			siginfo_t info {};
+			int options = WEXITED | WSTOPPED | __WALL | (own_child ? WNOWAIT : 0);
+
+			if (waitid(P_PID, pid, &info, options) < 0) {
+				if (errno == EINTR)
+					continue;
+				throw std::runtime_error(pwn::format("Could not wait for process {}: {}", pid, strerror(errno)));
+			}
+
+			if (detail::is_exit(info)) {
+				ended = stop.exited = pwn::exit_status::from_siginfo(info);
+				breakpoints.clear();
+				return stop;
+			}
+
+			/* a stop peeked at with WNOWAIT is still pending, consuming it returns right away */
+			if (own_child) {
+				siginfo_t consumed {};
+				while ((waitid(P_PID, pid, &consumed, WSTOPPED | __WALL) < 0) && (errno == EINTR));
+			}
+
+			/* group stops and PTRACE_INTERRUPT of a seized process carry an event and deliver nothing */
+			if (info.si_status >> 8) {
+				pending_signal = 0;
+				return stop;
+			}
+
+			stop.signal = info.si_status & 0x7f;
+			pending_signal = stop.signal == SIGTRAP ? 0 : stop.signal;
+
+			/* only an executed int3 leaves pc behind a breakpoint, a single step over a one byte instruction can land there too */
+			if ((stop.signal == SIGTRAP) && impl_hit_int3()) {
+				pwn::registers regs = get_registers();
+				std::uintptr_t hit = impl_pc(regs) - 1;
+
+				if (breakpoints.contains(hit)) {
+					impl_pc(regs) = hit;
+					set_registers(regs);
+					stop.breakpoint = hit;
+				}
+			}
+
+			return stop;
+		}
+	}
+
+	/* the kernel reports an int3 with SI_KERNEL (TRAP_BRKPT on some), single steps with TRAP_TRACE */
+	bool impl_hit_int3() {
+		siginfo_t info {};
+		if (ptrace(PTRACE_GETSIGINFO, pid, nullptr, &info) < 0)
+			return false;
+
+		return (info.si_code == SI_KERNEL) || (info.si_code == TRAP_BRKPT);
+	}
+
+	/* puts the original bytes back where read data covers our int3s, so it shows what the program really has */
+	void impl_unpatch(std::uintptr_t address, char *data, std::size_t length) {
+		for (auto &[breakpoint, original] : breakpoints) {
+			if ((breakpoint >= address) && (breakpoint - address < length))
+				data[breakpoint - address] = static_cast<char>(original);
+		}
+	}
+
+	std::uint8_t impl_poke_byte(std::uintptr_t address, std::uint8_t byte) {
+		errno = 0;
+		long word = ptrace(PTRACE_PEEKTEXT, pid, address, nullptr);
+		if (errno)
+			throw std::runtime_error(pwn::format("Could not read code at {:#x} of process {}", address, pid));
+
+		std::uint8_t original = word & 0xff;
+		word = (word & ~0xffL) | byte;
+
+		impl_ptrace(PTRACE_POKETEXT, reinterpret_cast<void *>(address), reinterpret_cast<void *>(word), "write code of");
+		return original;
+	}
+
+	/* steps over the breakpoint the process stands on (if any) with the original instruction in place */
+	debug_stop impl_step_over() {
+		pwn::registers regs = get_registers();
+		auto itr = breakpoints.find(impl_pc(regs));
+
+		if (itr == breakpoints.end()) {
+			impl_ptrace(PTRACE_SINGLESTEP, nullptr, reinterpret_cast<void *>(static_cast<long>(std::exchange(pending_signal, 0))), "step");
+			return impl_wait();
+		}
+
+		std::uintptr_t address = itr->first;
+		impl_poke_byte(address, itr->second);
+
+		impl_ptrace(PTRACE_SINGLESTEP, nullptr, reinterpret_cast<void *>(static_cast<long>(std::exchange(pending_signal, 0))), "step");
+		debug_stop stop = impl_wait();
+
+		if (!stop.exited && breakpoints.contains(address))
+			impl_poke_byte(address, 0xcc);
+
+		return stop;
+	}
+
+	/*
+		Moves the ranges between local and remote with as few calls as IOV_MAX allows. A range which could not be
+		moved completely is marked as failed and the batch goes on behind it.
+	*/
+	std::vector<bool> impl_transfer(std::vector<iovec> &local, std::vector<iovec> &remote, bool writing) {
+		std::vector<bool> moved(remote.size(), false);
+		std::size_t next = 0;
+
+		while (next < remote.size()) {
+			std::size_t count = std::min<std::size_t>(remote.size() - next, IOV_MAX);
+			ssize_t result = writing ?
+				process_vm_writev(pid, &local[next], count, &remote[next], count, 0) :
+				process_vm_readv(pid, &local[next], count, &remote[next], count, 0);
+
+			if (result < 0) {
+				if (errno == EINTR)
+					continue;
+				if ((errno != EFAULT) && (errno != EIO))
+					throw std::runtime_error(pwn::format("Could not access the memory of process {}: {}", pid, strerror(errno)));
+
+				/* nothing at all could be moved, so the very first range is the one at fault */
+				next++;
+				continue;
+			}
+
+			std::size_t left = result;
+			std::size_t end = next + count;
+
+			while ((next < end) && (left >= remote[next].iov_len)) {
+				left -= remote[next].iov_len;
+				moved[next++] = true;
+			}
+
+			if (next < end)
+				next++;
+		}
+
+		return moved;
+	}
+
+	static bool impl_matches(std::string_view mapped, std::string_view object) {
+		if (mapped == object)
+			return true;
+
+		std::string_view name = object.substr(object.find_last_of('/') + 1);
+		return mapped.ends_with(pwn::format("/{}", name));
+	}
+public:
+	template<int flags>
+	debugger(pwn::instance<flags> &target): pid(target.get_pid()) {
+		static_assert(flags & pwnflag::local, "Only pwn::local instances have a process to debug");
+
+		if (pid <= 0)
+			throw std::runtime_error("The instance has no process to debug");
+
+		std::ifstream stat(pwn::format("/proc/{}/stat", pid));
+		std::string line;
+		std::getline(stat, line);
+		std::istringstream fields(line.substr(line.find_last_of(')') + 2));
+
+		char state;
+		pid_t parent = -1;
+		fields >> state >> parent;
+		own_child = parent == getpid();
+
+		if (target.is_traced()) {
+			/* stopped by the SIGTRAP of its execve, which is not passed on */
+			impl_wait();
+			impl_check_stopped();
+			impl_ptrace(PTRACE_SETOPTIONS, nullptr, reinterpret_cast<void *>(PTRACE_O_EXITKILL), "set options of");
+			pending_signal = 0;
+			return;
+		}
+
+		impl_ptrace(PTRACE_SEIZE, nullptr, reinterpret_cast<void *>(PTRACE_O_EXITKILL), "attach to");
+		impl_ptrace(PTRACE_INTERRUPT, nullptr, nullptr, "interrupt");
+		impl_wait();
+	}
+
+	debugger(const debugger &) = delete;
+	debugger &operator=(const debugger &) = delete;
+
+	/* takes the breakpoints out again and lets the process run on */
+	~debugger() {
+		if (ended)
+			return;
+
+		for (auto &[address, original] : breakpoints) {
+			try {
+				impl_poke_byte(address, original);
+			}
+			catch (...) {}
+		}
+
+		ptrace(PTRACE_DETACH, pid, nullptr, reinterpret_cast<void *>(static_cast<long>(pending_signal)));
+	}
+
+	/* runs the process until it hits a breakpoint, receives a signal or ends. A signal it stopped with is delivered */
+	debug_stop cont() {
+		impl_check_stopped();
+
+		/* the instruction under a breakpoint we stand on has to run before the int3 goes back in */
+		pwn::registers regs = get_registers();
+		if (breakpoints.contains(impl_pc(regs))) {
+			debug_stop stop = impl_step_over();
+			if (stop.exited || stop.signal != SIGTRAP || stop.breakpoint)
+				return stop;
+		}
+
+		impl_ptrace(PTRACE_CONT, nullptr, reinterpret_cast<void *>(static_cast<long>(std::exchange(pending_signal, 0))), "continue");
+		return impl_wait();
+	}
+
+	/* runs a single instruction */
+	debug_stop step() {
+		impl_check_stopped();
+		return impl_step_over();
+	}
+
+	void break_at(std::uintptr_t address) {
+		impl_check_stopped();
+
+		if (breakpoints.contains(address))
+			return;
+
+		breakpoints[address] = impl_poke_byte(address, 0xcc);
+	}
+
+	/* places a breakpoint at symbol of binary where it is loaded right now, returns its address */
+	template<pwnflag width>
+	std::uintptr_t break_at(pwn::elf<width> &binary, std::string symbol) {
+		std::uintptr_t address = resolve(binary, symbol);
+		break_at(address);
+		return address;
+	}
+
+	void remove_breakpoint(std::uintptr_t address) {
+		impl_check_stopped();
+
+		auto itr = breakpoints.find(address);
+		if (itr == breakpoints.end())
+			return;
+
+		impl_poke_byte(address, itr->second);
+		breakpoints.erase(itr);
+	}
+
+	pwn::registers get_registers() {
+		pwn::registers regs {};
+		impl_ptrace(PTRACE_GETREGS, nullptr, &regs, "read the registers of");
+		return regs;
+	}
+
+	void set_registers(const pwn::registers &regs) {
+		impl_ptrace(PTRACE_SETREGS, nullptr, const_cast<pwn::registers *>(&regs), "write the registers of");
+	}
+
+	std::uintptr_t get_pc() {
+		pwn::registers regs = get_registers();
+		return impl_pc(regs);
+	}
+
+	/*
+		Where object (a path or just its file name, the executable if empty) starts in the process,
+		the lowest address it is mapped at.
+	*/
+	std::uintptr_t get_base(std::string_view object = "") {
+		std::string wanted(object);
+
+		if (wanted.empty()) {
+			char exe[PATH_MAX];
+			ssize_t length = readlink(pwn::format("/proc/{}/exe", pid).c_str(), exe, sizeof(exe));
+			if (length < 0)
+				throw std::runtime_error(pwn::format("Could not find the executable of process {}", pid));
+
+			wanted.assign(exe, length);
+		}
+
+		std::ifstream maps(pwn::format("/proc/{}/maps", pid));
+		std::string line;
+		std::uintptr_t base = UINTPTR_MAX;
+
+		while (std::getline(maps, line)) {
+			std::size_t path = line.find('/');
+			if ((path == std::string::npos) || !impl_matches(std::string_view(line).substr(path), wanted))
+				continue;
+
+			base = std::min<std::uintptr_t>(base, std::stoull(line, nullptr, 16));
+		}
+
+		if (base == UINTPTR_MAX)
+			throw std::runtime_error(pwn::format("{} is not mapped into process {}", wanted, pid));
+
+		return base;
+	}
+
+	/* the runtime address of symbol: its value from pwn::elf plus where binary got loaded (nothing for non-PIE executables) */
+	template<pwnflag width>
+	std::uintptr_t resolve(pwn::elf<width> &binary, std::string symbol) {
+		std::uintptr_t lowest = UINTPTR_MAX;
+		for (auto &segment : binary.get_segments()) {
+			if (segment.type == PT_LOAD)
+				lowest = std::min<std::uintptr_t>(lowest, segment.virtaddr);
+		}
+
+		if (lowest == UINTPTR_MAX)
+			throw std::runtime_error(pwn::format("{} has no loadable segment", binary.path));
+
+		std::uintptr_t page = sysconf(_SC_PAGESIZE);
+		std::uintptr_t bias = get_base(binary.path) - (lowest & ~(page - 1));
+
+		return bias + binary.get_symbol(symbol).value;
+	}
+
+	/* length bytes at address, throws unless all of them are readable */
+	std::string read(std::uintptr_t address, std::size_t length) {
+		std::vector<std::string> read_back = read({{address, length}});
+		if (read_back[0].length() != length)
+			throw std::runtime_error(pwn::format("Could not read {} bytes at {:#x} of process {}", length, address, pid));
+
+		return std::move(read_back[0]);
+	}
+
+	/* every range in one batch, ranges which are not readable as a whole come back empty. Breakpoints do not show */
+	std::vector<std::string> read(const std::vector<pwn::memory_range> &ranges) {
+		std::vector<std::string> read_back(ranges.size());
+		std::vector<iovec> local(ranges.size()), remote(ranges.size());
+
+		for (std::size_t i = 0; i < ranges.size(); i++) {
+			read_back[i].resize(ranges[i].length);
+			local[i] = {read_back[i].data(), ranges[i].length};
+			remote[i] = {reinterpret_cast<void *>(ranges[i].address), ranges[i].length};
+		}
+
+		std::vector<bool> moved = impl_transfer(local, remote, false);
+		for (std::size_t i = 0; i < ranges.size(); i++) {
+			if (!moved[i])
+				read_back[i].clear();
+			else if (!breakpoints.empty())
+				impl_unpatch(ranges[i].address, read_back[i].data(), ranges[i].length);
+		}
+
+		return read_back;
+	}
+
+	/*
+		The pointer sized word at every address in one batch, nullopt where it is not readable.
+		Runs of consecutive addresses are read as one range, and only split up again if the range is not readable.
+	*/
+	std::vector<std::optional<std::uintptr_t>> read_words(const std::vector<std::uintptr_t> &addresses) {
+		constexpr std::size_t word = sizeof(std::uintptr_t);
+		std::vector<std::uintptr_t> words(addresses.size());
+		std::vector<iovec> local, remote;
+		std::vector<std::size_t> starts;
+
+		for (std::size_t i = 0; i < addresses.size(); i++) {
+			if (!remote.empty() && (addresses[i] == addresses[i - 1] + word)) {
+				local.back().iov_len += word;
+				remote.back().iov_len += word;
+				continue;
+			}
+
+			starts.push_back(i);
+			local.push_back({&words[i], word});
+			remote.push_back({reinterpret_cast<void *>(addresses[i]), word});
+		}
+
+		std::vector<bool> moved = impl_transfer(local, remote, false);
+		std::vector<bool> readable(addresses.size(), false);
+		std::vector<iovec> retry_local, retry_remote;
+		std::vector<std::size_t> retried;
+
+		for (std::size_t run = 0; run < starts.size(); run++) {
+			std::size_t count = remote[run].iov_len / word;
+
+			for (std::size_t i = starts[run]; i < starts[run] + count; i++) {
+				if (moved[run]) {
+					readable[i] = true;
+				}
+				else if (count > 1) {
+					retried.push_back(i);
+					retry_local.push_back({&words[i], word});
+					retry_remote.push_back({reinterpret_cast<void *>(addresses[i]), word});
+				}
+			}
+		}
+
+		if (!retried.empty()) {
+			std::vector<bool> moved_alone = impl_transfer(retry_local, retry_remote, false);
+			for (std::size_t i = 0; i < retried.size(); i++)
+				readable[retried[i]] = moved_alone[i];
+		}
+
+		std::vector<std::optional<std::uintptr_t>> read_back(addresses.size());
+		for (std::size_t i = 0; i < addresses.size(); i++) {
+			if (!readable[i])
+				continue;
+
+			if (!breakpoints.empty())
+				impl_unpatch(addresses[i], reinterpret_cast<char *>(&words[i]), word);
+			read_back[i] = words[i];
+		}
+
+		return read_back;
+	}
+
+	/* writes data at address, which has to be writable for the process itself (use breakpoints for code) */
+	void write(std::uintptr_t address, std::string_view data) {
+		write({{address, std::string(data)}});
+	}
+
+	/* every piece in one batch, throws if any of them could not be written completely */
+	void write(const std::vector<std::pair<std::uintptr_t, std::string>> &pieces) {
+		std::vector<iovec> local(pieces.size()), remote(pieces.size());
+
+		for (std::size_t i = 0; i < pieces.size(); i++) {
+			local[i] = {const_cast<char *>(pieces[i].second.data()), pieces[i].second.length()};
+			remote[i] = {reinterpret_cast<void *>(pieces[i].first), pieces[i].second.length()};
+		}
+
+		std::vector<bool> moved = impl_transfer(local, remote, true);
+		for (std::size_t i = 0; i < pieces.size(); i++) {
+			if (!moved[i])
+				throw std::runtime_error(pwn::format("Could not write {} bytes at {:#x} of process {}", pieces[i].second.length(), pieces[i].first, pid));
+		}
+	}
+
+	pid_t get_pid() const {
+		return pid;
+	}
+};
+
+}
@@ -2,6 +2,8 @@
 
 #include <cppwnlib/basic/basic.hpp>
 #include <cppwnlib/basic/config.hpp>
+#include <cppwnlib/basic/demangle.hpp>
+#include <cppwnlib/basic/leak.hpp>
 
 #include <stdexcept>
 #include <string>
@@ -653,6 +655,23 @@ public:
 		throw std::runtime_error(pwn::format("Could not find a function with name {}", name));
 	}
 
+	/*
+		The loadable segments as address ranges relocated to base, tagged with the segment index.
+		Pass them to pwn::scan_leak to find pointers into the binary in a leak.
+	*/
+	std::vector<address_range> get_ranges(std::size_t base = 0) {
+		std::vector<address_range> ranges;
+
+		for (std::size_t i = 0; i < segments.size(); i++) {
+			if (segments[i].type != PT_LOAD)
+				continue;
+
+			ranges.push_back({base + segments[i].virtaddr, base + segments[i].virtaddr + segments[i].memsize, i});
+		}
+
+		return ranges;
+	}
+
 	std::size_t get_address(std::size_t offset) {
 		if (relative_base)
 			return relative_base + offset;
@@ -1,6 +1,15 @@
 #pragma once
 #include "basic/basic.hpp"
 #include "basic/cyclic.hpp"
+#include "basic/shared_cyclic.hpp"
 #include "basic/context.hpp"
+#include "basic/payload.hpp"
+#include "basic/leak.hpp"
+#include "basic/demangle.hpp"
 #include "sockets/instance.hpp"
+#include "sockets/reactor.hpp"
+#include "sockets/bruteforce.hpp"
+#include "sockets/pool.hpp"
+#include "sockets/forkserver.hpp"
 #include "elf/elf.hpp"
+#include "debug/debugger.hpp"
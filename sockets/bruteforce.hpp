@@ -0,0 +1,360 @@
+#pragma once
+#include <cppwnlib/basic/format.hpp>
+#include <cppwnlib/sockets/instance.hpp>
+#include <cppwnlib/sockets/reactor.hpp>
+#include <cppwnlib/sockets/resolver.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace pwn {
+
+/* throughput of a brute_force, accumulated over all of its find calls */
+struct brute_stats {
+	std::size_t guesses = 0;
+	std::size_t errors = 0;
+	std::size_t cancelled = 0;
+
+	/* connections the engine currently allows in flight */
+	double concurrency = 0;
+	/* moving average of how long a guess took, from connecting to the oracle's verdict */
+	std::chrono::nanoseconds latency {0};
+	std::chrono::nanoseconds elapsed {0};
+
+	double guesses_per_second() const {
+		return elapsed.count() ? guesses / std::chrono::duration<double>(elapsed).count() : 0;
+	}
+};
+
+/*
+	Tries guesses against a (typically forking) server over many connections at once, all driven by one pwn::reactor.
+	Every guess gets a fresh connection, connected without blocking, on which the oracle task decides whether it was right.
+	The amount of connections in flight adapts like a congestion window: it grows while guesses succeed without
+	the latency going up and halves when a connect fails or a guess times out, between 1 and max_concurrency. Those guesses are retried.
+	The first confirmed guess cancels everything still in flight.
+
+	pwn::brute_force<pwn::remote | pwn::bit64> brute("127.0.0.1", 1337);
+	std::string canary = brute.find_bytes(7, [&](pwn::instance<pwn::remote | pwn::bit64> &r, std::string_view guess, bool &hit) -> pwn::task {
+		co_await r.async_recvuntil("> ");
+		co_await r.async_send(padding + std::string(guess));
+		hit = (co_await r.async_recvline()).starts_with("bye");
+	}, std::string(1, '\0'));
+*/
+template<int flags>
+class brute_force {
+public:
+	using guesses = std::function<std::optional<std::string>()>;
+	using oracle = std::function<pwn::task(pwn::instance<flags> &, std::string_view, bool &)>;
+private:
+	using clock = std::chrono::steady_clock;
+
+	struct attempt {
+		std::string guess;
+		unsigned tries = 0;
+		bool hit = false;
+		bool expired = false;
+		/* could not connect or a step of the oracle timed out, the guess is retried */
+		bool lost = false;
+		clock::time_point started;
+		int sockid = -1;
+		std::optional<std::uint64_t> deadline;
+		std::unique_ptr<pwn::instance<flags>> target;
+		std::optional<pwn::task> verdict;
+	};
+
+	std::string host;
+	int port;
+	pwn::endpoint target_address;
+
+	std::size_t max_concurrency;
+	double window;
+	unsigned max_tries = 3;
+	std::chrono::milliseconds timeout {5000};
+
+	std::chrono::nanoseconds best_latency = std::chrono::nanoseconds::max();
+	pwn::brute_stats stats;
+
+	/* the reactor has to outlive every instance on it, so it is declared first */
+	pwn::reactor loop;
+	std::vector<std::shared_ptr<attempt>> in_flight;
+	std::deque<std::pair<std::string, unsigned>> retries;
+	bool failed_launch = false;
+
+	int impl_connect() {
+		int sockid = socket(target_address.family(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (sockid < 0)
+			throw std::runtime_error(pwn::format("Failed to establish a socket to {}:{}", host, port));
+
+		if ((connect(sockid, reinterpret_cast<sockaddr *>(&target_address.address), target_address.length) < 0) && (errno != EINPROGRESS)) {
+			close(sockid);
+			return -1;
+		}
+
+		return sockid;
+	}
+
+	/* whether the peer closed or reset the connection on sockid */
+	static bool impl_dropped(int sockid) {
+		pollfd fd = {.fd = sockid, .events = POLLRDHUP, .revents = 0};
+		return (poll(&fd, 1, 0) > 0) && (fd.revents & (POLLRDHUP | POLLHUP | POLLERR));
+	}
+
+	/*
+		A forking target often resets the connection on a wrong guess, so once connected, the connection
+		breaking under the oracle is its verdict: a miss. Other errors of the oracle end the search.
+	*/
+	pwn::task impl_attempt(attempt &a, const oracle &check) {
+		int error = co_await detail::reactor_awaitable<int>([&a](pwn::reactor &loop, auto deliver, auto, auto) {
+			loop.connected(*a.target, deliver);
+		});
+
+		if (error) {
+			a.lost = true;
+			co_return;
+		}
+
+		try {
+			co_await check(*a.target, a.guess, a.hit);
+		}
+		catch (const pwn::timeout_error &) {
+			a.lost = true;
+		}
+		catch (const std::runtime_error &) {
+			if (!impl_dropped(a.sockid))
+				throw;
+
+			a.hit = false;
+		}
+	}
+
+	void impl_launch(std::string guess, unsigned tries, const oracle &check) {
+		auto a = std::make_shared<attempt>();
+		a->guess = std::move(guess);
+		a->tries = tries;
+		a->started = clock::now();
+		in_flight.push_back(a);
+
+		int sockid = impl_connect();
+		if (sockid < 0) {
+			a->expired = true;
+			failed_launch = true;
+			return;
+		}
+
+		a->sockid = sockid;
+		a->target = std::make_unique<pwn::instance<flags>>(pwn::adopt_socket, sockid);
+		a->verdict.emplace(impl_attempt(*a, check));
+
+		a->deadline = loop.after(timeout, [weak = std::weak_ptr<attempt>(a)]() {
+			if (auto expired = weak.lock())
+				expired->expired = true;
+		});
+
+		loop.start(*a->verdict);
+	}
+
+	/* destroys the task first so it lets go of its instance, then the instance which unregisters from the reactor */
+	void impl_cancel(attempt &a) {
+		if (a.deadline)
+			loop.cancel(*std::exchange(a.deadline, std::nullopt));
+
+		a.verdict.reset();
+		a.target.reset();
+	}
+
+	void impl_cancel_all() {
+		for (auto &a : in_flight) {
+			impl_cancel(*a);
+			stats.cancelled++;
+		}
+
+		in_flight.clear();
+		retries.clear();
+	}
+
+	void impl_succeeded(const attempt &a) {
+		std::chrono::nanoseconds took = clock::now() - a.started;
+
+		stats.guesses++;
+		stats.latency = stats.latency.count() ? (stats.latency * 7 + took) / 8 : took;
+		best_latency = std::min(best_latency, took);
+
+		/* additive increase while the target keeps up, back off once queueing shows up in the latency */
+		if (stats.latency < 2 * best_latency)
+			window = std::min<double>(max_concurrency, window + 1 / window);
+		else
+			window = std::max(1.0, window - 1 / window);
+	}
+
+	void impl_failed(attempt &a) {
+		stats.errors++;
+		window = std::max(1.0, window / 2);
+
+		if (a.tries + 1 < max_tries) {
+			retries.emplace_back(std::move(a.guess), a.tries + 1);
+			return;
+		}
+
+		impl_cancel_all();
+		throw std::runtime_error(pwn::format("Guess could not connect or timed out {} times against {}:{}", max_tries, host, port));
+	}
+public:
+	brute_force(std::string host, int port, std::size_t max_concurrency = 64):
+		host(std::move(host)), port(port), max_concurrency(std::max<std::size_t>(max_concurrency, 1)) {
+		target_address = pwn::resolver::shared().resolve(this->host, port).front();
+
+		window = std::min<double>(8, this->max_concurrency);
+		stats.concurrency = window;
+	}
+
+	brute_force(const brute_force &) = delete;
+	brute_force &operator=(const brute_force &) = delete;
+
+	~brute_force() {
+		impl_cancel_all();
+	}
+
+	/*
+		Runs check on guesses from next until one is confirmed and returns it, nullopt if next ran out first.
+		A guess which timed out or could not connect is retried and throws once it failed max_tries times.
+		A connection the target closed or reset during check counts as a miss, anything else check throws escapes.
+	*/
+	std::optional<std::string> find(guesses next, oracle check) {
+		clock::time_point began = clock::now();
+		bool exhausted = false;
+
+		/* also when an error escapes: nothing may outlive check, and the time counts */
+		struct finish {
+			brute_force &self;
+			clock::time_point began;
+
+			~finish() {
+				self.impl_cancel_all();
+				self.stats.elapsed += clock::now() - began;
+				self.stats.concurrency = self.window;
+			}
+		} finishing {*this, began};
+
+		while (true) {
+			while (in_flight.size() < static_cast<std::size_t>(window)) {
+				if (!retries.empty()) {
+					auto [guess, tries] = std::move(retries.front());
+					retries.pop_front();
+					impl_launch(std::move(guess), tries, check);
+				}
+				else if (!exhausted) {
+					std::optional<std::string> guess = next();
+					if (!guess) {
+						exhausted = true;
+						continue;
+					}
+
+					impl_launch(std::move(*guess), 0, check);
+				}
+				else {
+					break;
+				}
+			}
+
+			if (in_flight.empty())
+				return std::nullopt;
+
+			/* attempts which could not even connect are collected right away */
+			loop.poll(std::exchange(failed_launch, false) ? 0 : -1);
+
+			for (std::size_t i = 0; i < in_flight.size();) {
+				attempt &a = *in_flight[i];
+
+				if (!a.expired && !a.verdict->done()) {
+					i++;
+					continue;
+				}
+
+				std::shared_ptr<attempt> finished = std::move(in_flight[i]);
+				in_flight[i] = std::move(in_flight.back());
+				in_flight.pop_back();
+
+				std::exception_ptr error = a.verdict ? a.verdict->get_error() : nullptr;
+				bool failed = !a.verdict || !a.verdict->done() || a.lost;
+
+				impl_cancel(a);
+
+				if (error) {
+					impl_cancel_all();
+					std::rethrow_exception(error);
+				}
+
+				if (failed) {
+					impl_failed(a);
+					continue;
+				}
+
+				impl_succeeded(a);
+
+				if (a.hit) {
+					impl_cancel_all();
+					return std::move(a.guess);
+				}
+			}
+		}
+	}
+
+	/*
+		Brute forces count bytes one after another, each found by trying all 256 values behind what is known so far.
+		check is given known plus the guessed bytes. Returns only the bytes found.
+	*/
+	std::string find_bytes(std::size_t count, oracle check, std::string known = "") {
+		std::size_t prefix = known.length();
+
+		for (std::size_t i = 0; i < count; i++) {
+			std::optional<std::string> found = find(bytes(known), check);
+			if (!found)
+				throw std::runtime_error(pwn::format("No byte value was confirmed at offset {}", known.length()));
+
+			known = std::move(*found);
+		}
+
+		return known.substr(prefix);
+	}
+
+	/* every byte value appended to prefix, in order */
+	static guesses bytes(std::string prefix = "") {
+		return [prefix = std::move(prefix), value = 0]() mutable -> std::optional<std::string> {
+			if (value > 0xff)
+				return std::nullopt;
+
+			return prefix + static_cast<char>(value++);
+		};
+	}
+
+	/* how long one guess may take in total before it counts as failed */
+	void set_timeout(std::chrono::milliseconds ms) {
+		timeout = ms;
+	}
+
+	void set_max_tries(unsigned tries) {
+		max_tries = std::max(tries, 1u);
+	}
+
+	const pwn::brute_stats &get_stats() const {
+		return stats;
+	}
+};
+
+}
@@ -0,0 +1,625 @@
+#pragma once
+#include <cppwnlib/basic/basic.hpp>
+#include <cppwnlib/basic/format.hpp>
+#include <cppwnlib/sockets/socketbuffer.hpp>
+#include <cppwnlib/sockets/spawn.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <csignal>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace pwn {
+
+/* what forking the instances of a pwn::fork_server cost, from asking for one until its pid was known */
+struct fork_stats {
+	std::size_t spawns = 0;
+	std::chrono::nanoseconds elapsed {0};
+	std::chrono::nanoseconds longest {0};
+
+	std::chrono::nanoseconds average() const {
+		return spawns ? elapsed / static_cast<std::int64_t>(spawns) : std::chrono::nanoseconds(0);
+	}
+
+	double spawns_per_second() const {
+		return elapsed.count() ? spawns / std::chrono::duration<double>(elapsed).count() : 0;
+	}
+};
+
+namespace detail {
+
+/*
+	The LD_PRELOAD stub which turns a program into a fork server. Once the program reached its stop point (main, or
+	the function at CPPWNLIB_FORKSERVER_STOP) it waits on the control socket for pairs of fds and forks once for each,
+	the child continuing the program with them as stdin and stdout while the server answers with the child's pid.
+	The server reaps its children through a signalfd and reports their exit statuses on the control socket as well.
+	main is reached by wrapping it from __libc_start_main, any other function gets its entry overwritten with a jump
+	that is undone before the program goes on, which is x86-64 only and passes on the six integer argument registers.
+*/
+constexpr std::string_view fork_server_stub = R"stub(
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <link.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static int control = -1;
+static uintptr_t stop;
+static unsigned char *patched;
+static unsigned char saved[14];
+
+/* what the server tells the controller: the pid of a child it forked, or how one of its children ended */
+struct report {
+	int pid;
+	int status;
+	int forked;
+};
+
+static void tell(int pid, int status, int forked) {
+	struct report r = { pid, status, forked };
+	while (send(control, &r, sizeof(r), MSG_NOSIGNAL) < 0 && errno == EINTR);
+}
+
+/* returns in every forked child, the server itself never leaves */
+static void serve(void) {
+	struct sigaction reap;
+	memset(&reap, 0, sizeof(reap));
+	reap.sa_handler = SIG_DFL;
+	sigaction(SIGCHLD, &reap, 0);
+
+	/* children are reaped here as they exit, their statuses go to the controller */
+	sigset_t children, mask;
+	sigemptyset(&children);
+	sigaddset(&children, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &children, &mask);
+	int exits = signalfd(-1, &children, SFD_CLOEXEC | SFD_NONBLOCK);
+
+	/* whatever the program printed so far went to the server's /dev/null, not to every child */
+	fflush(0);
+
+	for (;;) {
+		struct pollfd fds[2] = { { control, POLLIN, 0 }, { exits, POLLIN, 0 } };
+		if (poll(fds, 2, -1) < 0)
+			continue;
+
+		if (fds[1].revents) {
+			struct signalfd_siginfo info;
+			while (read(exits, &info, sizeof(info)) > 0);
+
+			int status;
+			pid_t pid;
+			while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+				tell(pid, status, 0);
+		}
+
+		if (!fds[0].revents)
+			continue;
+
+		char byte;
+		int pipes[2];
+		union {
+			struct cmsghdr header;
+			char space[CMSG_SPACE(sizeof(pipes))];
+		} ancillary;
+		struct iovec io = { &byte, 1 };
+		struct msghdr message;
+
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = &io;
+		message.msg_iovlen = 1;
+		message.msg_control = ancillary.space;
+		message.msg_controllen = sizeof(ancillary.space);
+
+		ssize_t received = recvmsg(control, &message, MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+		if (received < 0 && (errno == EINTR || errno == EAGAIN))
+			continue;
+		if (received <= 0)
+			_exit(0);
+
+		struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+		if (!header || header->cmsg_type != SCM_RIGHTS || header->cmsg_len != CMSG_LEN(sizeof(pipes)))
+			_exit(1);
+		memcpy(pipes, CMSG_DATA(header), sizeof(pipes));
+
+		pid_t pid = fork();
+		if (pid == 0) {
+			close(exits);
+			close(control);
+			sigprocmask(SIG_SETMASK, &mask, 0);
+
+			dup2(pipes[0], 0);
+			dup2(pipes[1], 1);
+			close(pipes[0]);
+			close(pipes[1]);
+			clearerr(stdin);
+			return;
+		}
+
+		close(pipes[0]);
+		close(pipes[1]);
+		tell(pid < 0 ? -1 : pid, pid < 0 ? errno : 0, 1);
+	}
+}
+
+typedef int (*main_function)(int, char **, char **);
+static main_function real_main;
+
+static int wrapped_main(int argc, char **argv, char **envp) {
+	serve();
+	return real_main(argc, argv, envp);
+}
+
+int __libc_start_main(main_function main, int argc, char **argv, void (*init)(void), void (*fini)(void),
+	void (*rtld_fini)(void), void *stack_end) {
+	int (*real)(main_function, int, char **, void (*)(void), void (*)(void), void (*)(void), void *) =
+		dlsym(RTLD_NEXT, "__libc_start_main");
+
+	if (control >= 0 && !stop) {
+		real_main = main;
+		main = wrapped_main;
+	}
+
+	return real(main, argc, argv, init, fini, rtld_fini, stack_end);
+}
+
+static int protect(int mode) {
+	uintptr_t page = sysconf(_SC_PAGESIZE);
+	uintptr_t start = (uintptr_t) patched & ~(page - 1);
+	uintptr_t end = ((uintptr_t) patched + sizeof(saved) + page - 1) & ~(page - 1);
+	return mprotect((void *) start, end - start, mode);
+}
+
+#if defined(__x86_64__)
+typedef long (*stopped_function)(long, long, long, long, long, long);
+
+static long hook(long a, long b, long c, long d, long e, long f) {
+	memcpy(patched, saved, sizeof(saved));
+	protect(PROT_READ | PROT_EXEC);
+	__builtin___clear_cache((char *) patched, (char *) patched + sizeof(saved));
+
+	serve();
+	return ((stopped_function) patched)(a, b, c, d, e, f);
+}
+#endif
+
+static int main_object(struct dl_phdr_info *info, size_t size, void *bias) {
+	*(uintptr_t *) bias = info->dlpi_addr;
+	return 1;
+}
+
+__attribute__((constructor)) static void setup(void) {
+	const char *fd = getenv("CPPWNLIB_FORKSERVER_FD");
+	const char *address = getenv("CPPWNLIB_FORKSERVER_STOP");
+	if (!fd)
+		return;
+
+	control = atoi(fd);
+	stop = address ? strtoull(address, 0, 16) : 0;
+	unsetenv("CPPWNLIB_FORKSERVER_FD");
+	unsetenv("CPPWNLIB_FORKSERVER_STOP");
+
+	if (!stop)
+		return;
+
+#if defined(__x86_64__)
+	uintptr_t bias = 0;
+	dl_iterate_phdr(main_object, &bias);
+	patched = (unsigned char *) (bias + stop);
+
+	/* jmp qword [rip]; dq hook */
+	unsigned char jump[sizeof(saved)] = { 0xff, 0x25, 0, 0, 0, 0 };
+	uintptr_t target = (uintptr_t) hook;
+	memcpy(jump + 6, &target, sizeof(target));
+
+	if (protect(PROT_READ | PROT_WRITE | PROT_EXEC) < 0)
+		_exit(126);
+
+	memcpy(saved, patched, sizeof(saved));
+	memcpy(patched, jump, sizeof(jump));
+#else
+	_exit(126);
+#endif
+}
+)stub";
+
+/* whether fd is ours and nobody else can write to it, anything else must not end up in LD_PRELOAD */
+inline bool fork_server_trusted(int fd) {
+	struct stat info;
+	return (fstat(fd, &info) == 0) && (info.st_uid == geteuid()) && !(info.st_mode & (S_IWGRP | S_IWOTH));
+}
+
+/*
+	Where compiled stubs are kept between runs, created if needed. There is no fallback to a shared directory
+	such as /tmp, where anyone could plant a library under the predictable name of the stub.
+*/
+inline std::string fork_server_cache() {
+	const char *xdg = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+
+	if (!(xdg && *xdg) && !(home && *home))
+		throw std::runtime_error("Neither XDG_CACHE_HOME nor HOME is set, there is nowhere to cache the fork server stub");
+
+	std::string base = xdg && *xdg ? xdg : pwn::format("{}/.cache", home);
+	mkdir(base.c_str(), 0700);
+
+	std::string dir = pwn::format("{}/cppwnlib", base);
+	if ((mkdir(dir.c_str(), 0700) < 0) && (errno != EEXIST))
+		throw std::runtime_error(pwn::format("Could not create {} to cache the fork server stub: {}", dir, strerror(errno)));
+
+	int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	bool trusted = (fd >= 0) && fork_server_trusted(fd);
+	if (fd >= 0)
+		close(fd);
+
+	if (!trusted)
+		throw std::runtime_error(pwn::format("{} is not a directory only we can write to, the fork server stub is not cached there", dir));
+
+	return dir;
+}
+
+/*
+	The stub as a shared object, compiled with $CC (cc by default) the first time it is needed and cached under a
+	name derived from its source, so a changed stub never picks up an old build.
+*/
+inline std::string fork_server_library() {
+	static std::mutex lock;
+	static std::string built;
+
+	std::lock_guard<std::mutex> guard(lock);
+	if (!built.empty())
+		return built;
+
+	std::string dir = fork_server_cache();
+	std::string library = pwn::format("{}/forkserver-{:x}.so", dir, std::hash<std::string_view>()(fork_server_stub));
+
+	/* a cached build is only used if it is ours, one which is not gets replaced below */
+	int cached = open(library.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (cached >= 0) {
+		bool trusted = fork_server_trusted(cached);
+		close(cached);
+
+		if (trusted)
+			return built = library;
+	}
+
+	/* built under names of our own and renamed into place, so concurrent builds never see half a library */
+	std::string source = pwn::format("{}/forkserver-{}.c", dir, getpid());
+	std::string partial = pwn::format("{}.{}", library, getpid());
+
+	FILE *file = fopen(source.c_str(), "w");
+	if (!file)
+		throw std::runtime_error(pwn::format("Could not write the fork server stub to {}", source));
+
+	bool written = fwrite(fork_server_stub.data(), 1, fork_server_stub.length(), file) == fork_server_stub.length();
+	if ((fclose(file) != 0) || !written) {
+		unlink(source.c_str());
+		throw std::runtime_error(pwn::format("Could not write the fork server stub to {}", source));
+	}
+
+	const char *compiler = getenv("CC");
+	std::vector<std::string> argv {compiler && *compiler ? compiler : "cc", "-shared", "-fPIC", "-O2",
+		"-o", partial, source, "-ldl"};
+
+	int null = open("/dev/null", O_RDWR | O_CLOEXEC);
+	int status = -1;
+
+	try {
+		pid_t pid = detail::spawn(argv, pwn::spawn_options(), null, null);
+		while ((waitpid(pid, &status, 0) < 0) && (errno == EINTR));
+	}
+	catch (...) {
+		close(null);
+		unlink(source.c_str());
+		throw;
+	}
+
+	close(null);
+	unlink(source.c_str());
+
+	/* whatever the umask made of it, the library must pass fork_server_trusted next time */
+	if (!WIFEXITED(status) || WEXITSTATUS(status) || (chmod(partial.c_str(), 0700) < 0) || (rename(partial.c_str(), library.c_str()) < 0)) {
+		unlink(partial.c_str());
+		throw std::runtime_error(pwn::format("Could not compile the fork server stub with {}", argv[0]));
+	}
+
+	return built = library;
+}
+
+}
+
+/*
+	Runs a local program once up to main (or the function at stop, a link time address such as
+	elf.get_symbol("vuln").value) and forks every further process off that warm image, which skips execve,
+	dynamic linking and libc initialization. Processes are asked for over a control socket by constructing
+	pwn::instance<pwn::local>(server), they behave like any other local instance.
+
+	pwn::fork_server server("./vuln");
+	for (auto &guess : guesses) {
+		pwn::instance<pwn::local | pwn::bit64> p(server);
+		...
+	}
+
+	The program runs with an LD_PRELOAD stub, compiled with $CC on first use and cached (see detail::fork_server_library).
+	Everything it does before the stop point happens once: output written by then is discarded and input read by
+	then sees end of file. Stopping at a function other than main works on x86-64 for functions which take up to
+	six integer or pointer arguments, and the program must not have started threads by then.
+*/
+class fork_server {
+private:
+	using clock = std::chrono::steady_clock;
+
+	std::string path;
+	pwn::spawn_options options;
+	pid_t server = -1;
+	int control = -1;
+
+	/* one message of the server, see report in the stub */
+	struct report {
+		int pid;
+		int status;
+		int forked;
+	};
+
+	std::mutex lock;
+	std::condition_variable reported;
+	bool reading = false;
+	bool gone = false;
+	pwn::fork_stats stats;
+
+	/* requests are answered in order, each fork waits for the answer with its number */
+	std::uint64_t requested = 0;
+	std::uint64_t answered = 0;
+	std::unordered_map<std::uint64_t, report> answers;
+	/* the children handed out and not forgotten yet, with their wait status once the server reaped them */
+	std::unordered_map<pid_t, std::optional<int>> children;
+
+	/*
+		Waits until a report of the server came in, guard is released meanwhile. Only one thread reads the control
+		socket at a time, the others wait for it to pass on what it read. False if until passed first.
+	*/
+	bool impl_receive(std::unique_lock<std::mutex> &guard, pwn::deadline until) {
+		if (reading)
+			return reported.wait_until(guard, until) == std::cv_status::no_timeout;
+
+		reading = true;
+		guard.unlock();
+
+		report r {};
+		ssize_t received = -1;
+		int error = EAGAIN;
+
+		try {
+			if (detail::socket_wait_until(control, POLLIN, until)) {
+				received = recv(control, &r, sizeof(r), MSG_DONTWAIT);
+				error = errno;
+			}
+		}
+		catch (...) {
+			guard.lock();
+			reading = false;
+			reported.notify_all();
+			throw;
+		}
+
+		guard.lock();
+		reading = false;
+
+		if ((received == 0) || ((received < 0) && (error != EAGAIN) && (error != EINTR))) {
+			gone = true;
+		}
+		else if (received == sizeof(r)) {
+			/* the child is known from here on, its exit may be reported before the thread which asked for it wakes up */
+			if (r.forked) {
+				answers[answered++] = r;
+				if (r.pid > 0)
+					children.emplace(r.pid, std::nullopt);
+			}
+			else if (auto child = children.find(r.pid); child != children.end())
+				child->second = r.status;
+		}
+
+		reported.notify_all();
+		return received >= 0;
+	}
+
+	void impl_start(const pwn::spawn_options &options, std::uint64_t stop, std::vector<std::string> argv) {
+		std::string library = detail::fork_server_library();
+
+		int ends[2];
+		if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, ends) < 0)
+			throw std::runtime_error(pwn::format("Could not create the control socket for {}", path));
+
+		/* a traced server would stop at its execve for good, its processes can be attached to instead */
+		pwn::spawn_options serving = options;
+		serving.trace = false;
+		const char *preloaded = nullptr;
+
+		if (serving.environment) {
+			for (auto &entry : *serving.environment) {
+				if (entry.starts_with("LD_PRELOAD="))
+					preloaded = entry.c_str() + 11;
+			}
+		}
+		else {
+			preloaded = getenv("LD_PRELOAD");
+		}
+
+		std::string preload = preloaded && *preloaded ? pwn::format("{}:{}", library, preloaded) : library;
+		serving.env("LD_PRELOAD", preload)
+			.env("CPPWNLIB_FORKSERVER_FD", std::to_string(ends[1]))
+			.pass_fd(ends[1]);
+
+		if (stop)
+			serving.env("CPPWNLIB_FORKSERVER_STOP", pwn::format("{:x}", stop));
+
+		int null = open("/dev/null", O_RDWR | O_CLOEXEC);
+
+		try {
+			server = detail::spawn(argv, serving, null, null);
+		}
+		catch (...) {
+			close(null);
+			close(ends[0]);
+			close(ends[1]);
+			throw;
+		}
+
+		close(null);
+		close(ends[1]);
+		control = ends[0];
+	}
+public:
+	template<typename ...Args>
+	fork_server(std::string path, Args&& ...args): fork_server(pwn::spawn_options(), 0, std::move(path), std::forward<Args>(args) ...) {}
+
+	/* stop is the link time address of the function to fork at, 0 for main */
+	template<typename ...Args>
+	fork_server(const pwn::spawn_options &options, std::uint64_t stop, std::string path, Args&& ...args): path(path), options(options) {
+		impl_start(options, stop, {path, pwn::detail::stringify(std::forward<Args>(args)) ...});
+	}
+
+	fork_server(const fork_server &) = delete;
+	fork_server &operator=(const fork_server &) = delete;
+
+	/*
+		The server is killed rather than waited for, it may never have reached the stop point to notice the closed
+		control socket. Processes forked from it keep running.
+	*/
+	~fork_server() {
+		close(control);
+		kill(server, SIGKILL);
+
+		while ((waitpid(server, nullptr, 0) < 0) && (errno == EINTR));
+	}
+
+	/*
+		Forks a new process with stdin_fd and stdout_fd as its stdin and stdout and returns its pid. Throws if the
+		server is gone, e.g. because the program exited or crashed before it reached the stop point.
+		The process is the server's child, its exit status is known through wait until it is forgotten.
+	*/
+	pid_t fork(int stdin_fd, int stdout_fd) {
+		std::unique_lock<std::mutex> guard(lock);
+		clock::time_point started = clock::now();
+
+		int fds[2] = {stdin_fd, stdout_fd};
+		char byte = 0;
+		union {
+			cmsghdr header;
+			char space[CMSG_SPACE(sizeof(fds))];
+		} ancillary {};
+
+		iovec io {.iov_base = &byte, .iov_len = 1};
+		msghdr message {};
+		message.msg_iov = &io;
+		message.msg_iovlen = 1;
+		message.msg_control = ancillary.space;
+		message.msg_controllen = sizeof(ancillary.space);
+
+		cmsghdr *header = CMSG_FIRSTHDR(&message);
+		header->cmsg_level = SOL_SOCKET;
+		header->cmsg_type = SCM_RIGHTS;
+		header->cmsg_len = CMSG_LEN(sizeof(fds));
+		std::memcpy(CMSG_DATA(header), fds, sizeof(fds));
+
+		ssize_t result;
+		while (((result = sendmsg(control, &message, MSG_NOSIGNAL)) < 0) && (errno == EINTR));
+
+		if (result != 1)
+			throw std::runtime_error(pwn::format("The fork server of {} is gone", path));
+
+		std::uint64_t ticket = requested++;
+		while (!answers.contains(ticket)) {
+			if (gone)
+				throw std::runtime_error(pwn::format("The fork server of {} is gone", path));
+
+			impl_receive(guard, pwn::deadline::max());
+		}
+
+		report answer = answers[ticket];
+		answers.erase(ticket);
+
+		if (answer.pid < 0)
+			throw std::runtime_error(pwn::format("The fork server of {} could not fork: {}", path, strerror(answer.status)));
+
+		std::chrono::nanoseconds took = clock::now() - started;
+		stats.spawns++;
+		stats.elapsed += took;
+		stats.longest = std::max(stats.longest, took);
+
+		return answer.pid;
+	}
+
+	/*
+		The wait status (as waitpid reports it) of a process this server forked, once the server reaped it.
+		nullopt if that did not happen before until, the server is gone or pid was forgotten.
+	*/
+	std::optional<int> wait(pid_t pid, pwn::deadline until = pwn::deadline::max()) {
+		std::unique_lock<std::mutex> guard(lock);
+
+		while (true) {
+			auto child = children.find(pid);
+			if (child == children.end())
+				return std::nullopt;
+			if (child->second)
+				return child->second;
+			if (gone || !impl_receive(guard, until))
+				return std::nullopt;
+		}
+	}
+
+	/* stops keeping track of pid, e.g. once its instance is gone */
+	void forget(pid_t pid) {
+		std::lock_guard<std::mutex> guard(lock);
+		children.erase(pid);
+	}
+
+	pid_t get_pid() const {
+		return server;
+	}
+
+	/* what the server was started with, its transport also connects the forked instances */
+	const pwn::spawn_options &get_options() const {
+		return options;
+	}
+
+	pwn::fork_stats get_stats() {
+		std::lock_guard<std::mutex> guard(lock);
+		return stats;
+	}
+
+	void reset_stats() {
+		std::lock_guard<std::mutex> guard(lock);
+		stats = pwn::fork_stats();
+	}
+};
+
+}
@@ -2,12 +2,21 @@
 #include <cppwnlib/basic/config.hpp>
 #include <cppwnlib/basic/context.hpp>
 #include <cppwnlib/sockets/socketbuffer.hpp>
-
-#include <atomic>
-#include <thread>
+#include <cppwnlib/sockets/resolver.hpp>
+#include <cppwnlib/sockets/spawn.hpp>
+#include <cppwnlib/sockets/forkserver.hpp>
+#include <cppwnlib/sockets/process.hpp>
+#include <cppwnlib/sockets/interactive.hpp>
+#include <cppwnlib/sockets/reactor.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <optional>
+#include <utility>
 
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <string.h>
 #include <unistd.h>
@@ -19,6 +28,16 @@ namespace pwn {
 template<int flags = 0>
 class instance;
 
+template<int flags>
+class instance_pool;
+
+/* tag for constructing an instance around a socket which was opened elsewhere, see instance(adopt_socket_t, int) */
+struct adopt_socket_t {
+	explicit adopt_socket_t() = default;
+};
+
+constexpr adopt_socket_t adopt_socket {};
+
 namespace detail {
 
 constexpr int read = 0;
@@ -27,32 +46,25 @@ constexpr int stdin = 0;
 constexpr int stdout = 1;
 constexpr int stderr = 2;
 
-bool is_ip(const std::string &s) {
-	std::string::const_iterator itr = s.begin();
-	
-	for (int i = 0; i < 4; i++) {
-		std::string::const_iterator itr2 = itr;
-		
-		while (itr != s.end() && std::isdigit(*itr))
-			itr++;
-
-		if ((itr == itr2) || (*itr++ != '.'))
-			return false;
-	}
-
-	return true;
-}
-
 }
 
 template<int flags>
 class instance {
+	friend class pwn::reactor;
+	friend class pwn::instance_pool<flags>;
 private:
 	context ctx;
 	std::string ip;
 	int port;
+	pid_t pid = -1;
+	int pidfd = -1;
+	pwn::fork_server *forked_from = nullptr;
+	std::optional<pwn::exit_status> status;
+	bool kill_on_destroy = true;
+	bool traced = false;
 
 	detail::SocketBuffer<flags> sb;
+	pwn::reactor *loop = nullptr;
 public:
 	instance() {}
 	// why tf doesn't sfinae work on constructors?
@@ -62,114 +74,170 @@ public:
 		constexpr bool is_remote = pwnflag::remote & flags;
 		constexpr bool is_local = pwnflag::local & flags;
 		if constexpr (is_remote) {
-			_instance_remote(pathorip, std::get<0>(std::forward_as_tuple(args ...)));
+			auto arguments = std::forward_as_tuple(args ...);
+
+			if constexpr (sizeof...(Args) > 1)
+				_instance_remote(pathorip, std::get<0>(arguments), std::get<1>(arguments));
+			else
+				_instance_remote(pathorip, std::get<0>(arguments));
 		}
 		else if constexpr (is_local) {
-			_instance_local(pathorip, std::forward<Args>(args) ...);
+			_instance_local(pwn::spawn_options(), pathorip, std::forward<Args>(args) ...);
 		}
 		else {
 			throw std::runtime_error("Incorrect flag for instance, please use either pwnflag::remote or pwnflag::local");
 		}
 	}
 
-private:
-	void _instance_remote(std::string ip, int port) {
-		int sockid = socket(AF_INET, SOCK_STREAM, 0);
-		if (sockid < 0) {
-			throw std::runtime_error(pwn::format("Failed to establish a socket to {}:{}", ip, port));
-		}
-
-		sockaddr_in server;
-		server.sin_family = AF_INET;
-		server.sin_port = htons(port);
+	/* a local process started as described by options, see pwn::spawn_options */
+	template<typename ...Args>
+	instance(const pwn::spawn_options &options, std::string path, Args&& ...args): ctx(flags & (pwn::bit64 | pwn::bit32)), sb() {
+		static_assert(flags & pwnflag::local, "spawn_options only apply to pwn::local instances");
+		_instance_local(options, path, std::forward<Args>(args) ...);
+	}
 
-		if (detail::is_ip(ip)) {
-			if (inet_pton(AF_INET, ip.c_str(), &server.sin_addr) < 1) {
-				throw std::runtime_error(pwn::format("Invalid ip: {}", ip));
-			}
+	/* a local process forked off the warm image of server, see pwn::fork_server */
+	instance(pwn::fork_server &server): ctx(flags & (pwn::bit64 | pwn::bit32)), sb() {
+		static_assert(flags & pwnflag::local, "fork_server only starts pwn::local instances");
+		forked_from = &server;
+		_instance_child(server.get_options(), [&server](int stdin_fd, int stdout_fd) { return server.fork(stdin_fd, stdout_fd); });
+	}
 
-			this->ip = std::move(ip);
-		}
-		else {
-			hostent *hent;
-			in_addr **ip_list;
-			
-			if (!(hent = gethostbyname(ip.c_str()))) {
-				throw std::runtime_error(pwn::format("Could not get host {} by name", ip));
-			}
+	/* takes ownership of sockid, which may still be connecting (see reactor::connected) */
+	instance(adopt_socket_t, int sockid): ctx(flags & (pwn::bit64 | pwn::bit32)), sb(sockid) {}
 
-			ip_list = reinterpret_cast<in_addr **>(hent->h_addr_list);
-			
-			char *real_ip = inet_ntoa(*ip_list[0]);
+private:
+	/*
+		Resolves host through the shared pwn::resolver (IPv4 and IPv6) and connects Happy Eyeballs style,
+		giving up after timeout.
+	*/
+	void _instance_remote(std::string host, int port, std::chrono::milliseconds timeout = std::chrono::seconds(10)) {
+		std::vector<pwn::endpoint> endpoints = pwn::resolver::shared().resolve(host, port);
 
-			if (!real_ip) {
-				throw std::runtime_error(pwn::format("Could not deduce ip from {}", ip));
-			}
+		pwn::endpoint chosen;
+		int sockid = detail::connect_any(endpoints, timeout, &chosen);
 
-			if (inet_pton(AF_INET, real_ip, &server.sin_addr) < 1) {
-				throw std::runtime_error(pwn::format("Invalid ip: {}", ip));
-			}
+		if (sockid < 0) {
+			if (errno == ETIMEDOUT)
+				throw std::runtime_error(pwn::format("Timed out connecting to {}:{}", host, port));
 
-			this->ip = std::string(real_ip);
+			throw std::runtime_error(pwn::format("Could not connect to {}:{}", endpoints.front().ip(), port));
 		}
 
-		if (connect(sockid, reinterpret_cast<sockaddr *>(&server), sizeof(server)) < 0) {
-			throw std::runtime_error(pwn::format("Could not connect to {}:{}", this->ip, port));
-		}
+		this->ip = chosen.ip();
+		this->port = port;
 
 		sb = detail::SocketBuffer<flags>(sockid);
 	}
 
 	template<typename ...Args>
-	void _instance_local(std::string path, Args&& ...args) {
-
+	void _instance_local(const pwn::spawn_options &options, std::string path, Args&& ...args) {
 		std::vector<std::string> argv {path, pwn::detail::stringify(std::forward<Args>(args)) ...};
 
-		int input_socket[2] = {0};
-		int output_socket[2] = {0};
-		pipe(input_socket);
-		pipe(output_socket);
+		detail::reaper::shared().collect();
+		_instance_child(options, [&](int stdin_fd, int stdout_fd) { return detail::spawn(argv, options, stdin_fd, stdout_fd); });
+		traced = options.trace;
+	}
 
-		int pid = fork();
+	/* a child which already exited and was reaped by a fork server gets no pidfd, its status comes from the server */
+	void impl_started(pid_t started) {
+		pid = started;
+		pidfd = detail::pidfd_open(pid);
+	}
 
-		auto pargv = new char *[argv.size() + 1]();
-		for (int i = 0; i < argv.size(); i++)
-			pargv[i] = const_cast<char *>(argv[i].c_str());
+	/*
+		Kills the process unless that was turned off, and makes sure it is reaped: right away after killing it,
+		later by detail::reaper otherwise. Processes of a fork server are reaped by the server.
+	*/
+	void impl_release() {
+		if (!status && kill_on_destroy)
+			kill(SIGKILL);
 
-		if (pid == 0) {
-    			/*
-			 * Make the program socket create duplicates to map to stdin, stdout, stderr.
-			 * Close the actual socket in the fork for clean-up.
-			*/
-			dup2(input_socket[detail::read], detail::stdin);
- 			dup2(output_socket[detail::write], detail::stdout);
-			//dup2(program_socket[detail::write], detail::stderr);
+		if (forked_from) {
+			forked_from->forget(pid);
+		}
+		else if ((pidfd >= 0) && !status) {
+			if (kill_on_destroy)
+				detail::pidfd_reap(pidfd);
+			else {
+				detail::reaper::shared().adopt(std::exchange(pidfd, -1));
+			}
+		}
 
-			close(input_socket[detail::read]);
-			close(input_socket[detail::write]);
-			close(output_socket[detail::read]);
-			close(output_socket[detail::write]);
+		if (pidfd >= 0)
+			close(pidfd);
+	}
 
-			/*
-			 * Construct an array for argv, nullptr terminated.
-			 * */
+	/*
+		Connects the process start creates from the fds it is given (see spawn_options::transport) to sb,
+		start returns its pid.
+	*/
+	template<typename Start>
+	void _instance_child(const pwn::spawn_options &options, Start start) {
+		if (options.connection == pwn::spawn_options::transport::socketpair) {
+			int ends[2];
+			if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, ends) < 0)
+				throw std::runtime_error("Could not create a socketpair for a local instance");
+
+			if (options.buffer_size) {
+				int size = static_cast<int>(std::min<std::size_t>(options.buffer_size, INT32_MAX));
+				for (int end : ends) {
+					setsockopt(end, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+					setsockopt(end, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+				}
+			}
 
-//			ptrace(PTRACE_TRACEME, pid, nullptr, nullptr); // PTRACE for debugging.
-			execvp(pargv[0], &pargv[0]);
+			try {
+				impl_started(start(ends[1], ends[1]));
+			}
+			catch (...) {
+				close(ends[0]);
+				close(ends[1]);
+				throw;
+			}
 
-			exit(0);
+			close(ends[1]);
+			sb = detail::SocketBuffer<flags>(ends[0]);
+			return;
 		}
-		else {
+
+		int input_socket[2] = {-1, -1};
+		int output_socket[2] = {-1, -1};
+
+		if ((pipe2(input_socket, O_CLOEXEC) < 0) || (pipe2(output_socket, O_CLOEXEC) < 0)) {
 			close(input_socket[detail::read]);
-			close(output_socket[detail::write]);
+			close(input_socket[detail::write]);
+			throw std::runtime_error("Could not create pipes for a local instance");
+		}
+
+		if (options.buffer_size) {
+			int size = static_cast<int>(std::min<std::size_t>(options.buffer_size, INT32_MAX));
+			fcntl(input_socket[detail::write], F_SETPIPE_SZ, size);
+			fcntl(output_socket[detail::write], F_SETPIPE_SZ, size);
+		}
 
-			sb = detail::SocketBuffer<flags>(output_socket[detail::read], input_socket[detail::write]);
+		try {
+			impl_started(start(input_socket[detail::read], output_socket[detail::write]));
+		}
+		catch (...) {
+			for (int fd : {input_socket[0], input_socket[1], output_socket[0], output_socket[1]})
+				close(fd);
+			throw;
 		}
-	
+
+		close(input_socket[detail::read]);
+		close(output_socket[detail::write]);
+
+		sb = detail::SocketBuffer<flags>(output_socket[detail::read], input_socket[detail::write]);
 	}
 
 public:
 	~instance() {
+		if (loop)
+			loop->remove(*this);
+
+		sb.flush();
+
 		if (sb.get_readsock() == sb.get_writesock()) {
 			close(sb.get_readsock());
 		}
@@ -177,82 +245,164 @@ public:
 			close(sb.get_readsock());
 			close(sb.get_writesock());
 		}
+
+		if (pid > 0)
+			impl_release();
 	}
 
 	std::string recv(const std::size_t length = 1024) {
 		return sb.read(length);
 	}
 
-	std::string recvuntil(const std::string &what, const std::size_t buffsize = 1024) {
-		std::string buffer("");
-		std::string new_part;
-		
-		while (true) {
-			new_part = sb.read(buffsize);
-			auto endline = new_part.find(what);
-		
-			if (endline != std::string::npos) {
-				if (endline < new_part.length()) {
-					sb.unread(new_part.substr(endline + what.length(), new_part.length()));
-					new_part.erase(endline + what.length(), new_part.length());
+	/* buffsize is the least amount of room made for each read from the socket */
+	std::string recvuntil(std::string_view what, const std::size_t buffsize = 1024) {
+		return sb.read_until(what, buffsize);
+	}
 
-				}
-				break;
-			}
+	std::string recvline(const std::size_t buffsize = 1024) {
+		return recvuntil("\n", buffsize);
+	}
 
-			if ((new_part == "") && (flags & noblocking))
-				break;
-			
-			buffer += new_part;
-		}
+	/*
+		Same as recv, recvuntil and recvline but the result points into the receive buffer instead of being copied,
+		it is only valid until the next receive call.
+	*/
+	std::string_view recv_view(const std::size_t length = 1024) {
+		return sb.read_view(length);
+	}
 
-		buffer += new_part;
-		return buffer;
+	std::string_view recvuntil_view(std::string_view what, const std::size_t buffsize = 1024) {
+		return sb.read_until_view(what, buffsize);
 	}
 
-	std::string recvline(const std::size_t buffsize = 1024) {
-		return recvuntil("\n", buffsize);
+	std::string_view recvline_view(const std::size_t buffsize = 1024) {
+		return recvuntil_view("\n", buffsize);
 	}
 
-	void send(const std::string &what, const std::size_t length = 0) {
-		sb.write(what, length ? length : what.length());
+	/*
+		Receives which give up at an absolute deadline on the monotonic clock instead of after the configured timeout,
+		e.g. r.recvline(std::chrono::steady_clock::now() + 5ms). The deadline holds for the whole call however
+		many reads it takes, what was received until then is returned.
+	*/
+	std::string recv(const std::size_t length, pwn::deadline until) {
+		return std::string(sb.read_view(length, until));
+	}
+
+	std::string recvuntil(std::string_view what, pwn::deadline until, const std::size_t buffsize = 1024) {
+		return std::string(sb.read_until_view(what, buffsize, until));
 	}
 
-	void sendline(const std::string &what) {
-		send(what + '\n');
+	std::string recvline(pwn::deadline until, const std::size_t buffsize = 1024) {
+		return recvuntil("\n", until, buffsize);
 	}
 
+	std::string_view recv_view(const std::size_t length, pwn::deadline until) {
+		return sb.read_view(length, until);
+	}
+
+	std::string_view recvuntil_view(std::string_view what, pwn::deadline until, const std::size_t buffsize = 1024) {
+		return sb.read_until_view(what, buffsize, until);
+	}
+
+	std::string_view recvline_view(pwn::deadline until, const std::size_t buffsize = 1024) {
+		return recvuntil_view("\n", until, buffsize);
+	}
+
+	void send(std::string_view what, const std::size_t length = 0) {
+		sb.write(what.data(), length ? length : what.length());
+	}
+
+	void sendline(std::string_view what) {
+		sb.write({what, "\n"});
+	}
+
+	/* sends all pieces with one syscall, e.g. r.sendv({header, body, "\n"}) */
+	void sendv(std::initializer_list<std::string_view> pieces) {
+		sb.write(pieces);
+	}
+
+	/*
+		Between cork and uncork every send is only queued, uncork then sends everything in one write,
+		as a single TCP segment where it fits. Useful when racing the target with a multi part payload.
+	*/
+	void cork() {
+		sb.cork();
+	}
+
+	void uncork() {
+		sb.uncork();
+	}
+
+	/* disable Nagle's algorithm on remotes so small sends go out immediately */
+	void set_nodelay(bool enable = true) {
+		sb.set_nodelay(enable);
+	}
+
+	/*
+		Awaitable versions of the functions above for tasks running on a pwn::reactor, see pwn::task.
+		With a timeout they throw pwn::timeout_error if it passes first, received data then stays buffered.
+	*/
+	auto async_recv(const std::size_t length = 1024, std::chrono::milliseconds timeout = {}) {
+		return detail::reactor_awaitable<std::string>([this, length, timeout](pwn::reactor &loop, auto deliver, auto expired, auto failed) {
+			loop.recv(*this, length, [deliver](std::string_view part) { deliver(std::string(part)); }, timeout, expired, failed);
+		});
+	}
+
+	auto async_recvuntil(std::string_view what, std::chrono::milliseconds timeout = {}) {
+		return detail::reactor_awaitable<std::string>([this, what = std::string(what), timeout](pwn::reactor &loop, auto deliver, auto expired, auto failed) {
+			loop.recvuntil(*this, what, [deliver](std::string_view part) { deliver(std::string(part)); }, timeout, expired, failed);
+		});
+	}
+
+	auto async_recvline(std::chrono::milliseconds timeout = {}) {
+		return async_recvuntil("\n", timeout);
+	}
+
+	auto async_send(std::string_view what, std::chrono::milliseconds timeout = {}) {
+		return detail::reactor_awaitable<detail::done>([this, what = std::string(what), timeout](pwn::reactor &loop, auto deliver, auto expired, auto failed) mutable {
+			loop.send(*this, std::move(what), [deliver]() { deliver({}); }, timeout, expired, failed);
+		});
+	}
+
+	auto async_sendline(std::string_view what, std::chrono::milliseconds timeout = {}) {
+		std::string line;
+		line.reserve(what.length() + 1);
+		line.append(what.data(), what.length());
+		line += '\n';
+
+		return async_send(line, timeout);
+	}
+
+	/*
+		How long receives without a deadline may take in total, negative for no limit.
+		pwn::noblocking instances start out with 100 ms, all others without a limit.
+	*/
 	void set_timeout(const int ms) {
-		if (!(flags & noblocking))
-			throw std::runtime_error("Only possible to set timeout on non-blocking remotes. Use pwn::nonblocking as a flag.");
-		
 		sb.set_timeout(ms);
 	}
 
-private:
-	static void _input_loop(std::atomic<bool> &loop, instance<flags> *that) {
-		std::string linebuffer;
-	
-		while (loop.load()) {
-			std::getline(std::cin, linebuffer);
-			if (linebuffer == "quit") {
-				loop = false;
-				break;
-			}
+	/* counts and durations of the waits for input which had a deadline, see pwn::timeout_stats */
+	const pwn::timeout_stats &get_timeout_stats() const {
+		return sb.get_timeout_stats();
+	}
 
-			that->sendline(linebuffer);
-		}
+	void reset_timeout_stats() {
+		sb.reset_timeout_stats();
 	}
-public:
+
+	/*
+		Forwards stdin to the instance and its output to stdout until either side reaches end of file or quit is typed.
+		Runs in the calling thread, output shows up as soon as it arrives and is spliced where possible, see detail::interactive.
+	*/
 	void interactive() {
-		std::atomic<bool> loop(true);
-		
-		std::thread input_thread(_input_loop, std::ref(loop), this);
+		std::cout << std::flush;
+		sb.settle();
 
-		while (loop.load()) {
-			std::string s = recvline();
-			std::cout << s;
-		}
+		std::string_view rest = sb.buffered();
+		detail::write_all(STDOUT_FILENO, rest.data(), rest.length());
+		sb.take(rest.length());
+
+		detail::interactive(sb.get_readsock(), sb.get_writesock());
 	}
 
 	/*
@@ -263,9 +413,101 @@ public:
 		return ctx.cyclic(amount);
 	}
 
+	/* sends amount cyclic characters through a small fixed buffer, findable with cyclic_find just like cyclic(amount) */
+	void send_cyclic(const std::size_t amount) {
+		char chunk[4096];
+		pwn::cyclic_stream stream = ctx.cyclic_stream(amount);
+
+		for (std::size_t n; (n = stream.read(chunk, sizeof(chunk)));)
+			sb.write(chunk, n);
+	}
+
 	std::size_t cyclic_find(const std::string pattern) {
 		return ctx.cyclic_find(pattern);
 	}
+
+	std::vector<cyclic_fragment> cyclic_scan(std::string_view buffer) {
+		return ctx.cyclic_scan(buffer);
+	}
+
+	/* take cyclic data from a sequence shared with other instances, e.g. one per parallel connection */
+	void share_cyclic(pwn::shared_cyclic &sequence) {
+		ctx.cyclic_share(sequence);
+	}
+
+	std::size_t cyclic_owner() const {
+		return ctx.cyclic_owner();
+	}
+
+	/* the process of a local instance, -1 for remotes */
+	pid_t get_pid() const {
+		return pid;
+	}
+
+	/* a pidfd of the process, readable once it exited (e.g. to wait on it with epoll), -1 for remotes */
+	int get_pidfd() const {
+		return pidfd;
+	}
+
+	/* sends sig to the process through its pidfd, false if it is gone already */
+	bool kill(int sig = SIGTERM) {
+		if (status || (pid <= 0))
+			return false;
+
+		if (pidfd >= 0)
+			return detail::pidfd_signal(pidfd, sig);
+
+		/* exited and reaped by its fork server before it could be opened, the pid may belong to anyone now */
+		return false;
+	}
+
+	/*
+		How the process ended, waiting for it to end until the deadline (pass steady_clock::now() to only check).
+		nullopt if it is still running by then, and always for remote instances.
+	*/
+	std::optional<pwn::exit_status> wait(pwn::deadline until = pwn::deadline::max()) {
+		if (status || (pid <= 0))
+			return status;
+
+		if ((pidfd >= 0) && !detail::socket_wait_until(pidfd, POLLIN, until))
+			return std::nullopt;
+
+		if (forked_from) {
+			/* once the process is gone the server reaps it right away */
+			std::optional<int> reaped = forked_from->wait(pid, pidfd >= 0 ? pwn::deadline::max() : until);
+			if (reaped)
+				status = pwn::exit_status::from_wait(*reaped);
+			return status;
+		}
+
+		/* only peeked at first, a stop of a traced process is left to its debugger */
+		siginfo_t info {};
+		if ((waitid(static_cast<idtype_t>(P_PIDFD), pidfd, &info, WEXITED | WNOHANG | WNOWAIT) < 0) || !detail::is_exit(info))
+			return std::nullopt;
+
+		status = pwn::exit_status::from_siginfo(info);
+		detail::pidfd_reap(pidfd);
+		return status;
+	}
+
+	/*
+		Waits until the process crashed (see exit_status::crashed) or the deadline passed. Costs a single wait on
+		the pidfd, false if the process is still running by then or ended some other way.
+	*/
+	bool wait_crash(pwn::deadline until) {
+		std::optional<pwn::exit_status> ended = wait(until);
+		return ended && ended->crashed();
+	}
+
+	/* whether the process was spawned stopped for a pwn::debugger, see spawn_options::traced */
+	bool is_traced() const {
+		return traced;
+	}
+
+	/* whether destroying the instance kills its process (the default), it is reaped either way */
+	void set_kill_on_destroy(bool enable) {
+		kill_on_destroy = enable;
+	}
 };
 
 }
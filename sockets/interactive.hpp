@@ -0,0 +1,220 @@
+#pragma once
+#include <cppwnlib/basic/format.hpp>
+#include <cppwnlib/sockets/socketbuffer.hpp>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace pwn {
+namespace detail {
+
+/* writes all of what to fd, blocking until it is out */
+inline void write_all(int fd, const char *what, std::size_t length) {
+	while (length) {
+		ssize_t written = ::write(fd, what, length);
+
+		if (written < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				socket_wait(fd, POLLOUT, -1);
+			else if (errno != EINTR)
+				throw std::runtime_error(pwn::format("Could not write to fd: {}", fd));
+			continue;
+		}
+
+		what += written;
+		length -= written;
+	}
+}
+
+/*
+	Moves whatever is available on one fd to another without copying it to user space: spliced directly when one
+	of them is a pipe, through a pipe of its own otherwise. fds which can not be spliced (some terminals, sockets
+	of old kernels) make it fall back to read and write.
+*/
+class forwarder {
+private:
+	static constexpr std::size_t chunk = 1 << 16;
+
+	int from, to;
+	int relay[2] = {-1, -1};
+	bool direct = false;
+	bool spliceable = true;
+
+	static bool is_pipe(int fd) {
+		struct stat info;
+		return (fstat(fd, &info) == 0) && S_ISFIFO(info.st_mode);
+	}
+
+	bool impl_copy() {
+		char buffer[chunk];
+		ssize_t received;
+
+		do
+			received = ::read(from, buffer, sizeof(buffer));
+		while (received < 0 && errno == EINTR);
+
+		if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return true;
+		if (received < 0)
+			throw std::runtime_error(pwn::format("Could not read from fd: {}", from));
+
+		write_all(to, buffer, received);
+		return received > 0;
+	}
+
+	/* moves length bytes sitting in the relay pipe on, by copying them if to turns out not to be spliceable */
+	void impl_drain(std::size_t length) {
+		while (length) {
+			ssize_t moved = spliceable ? splice(relay[0], nullptr, to, nullptr, length, SPLICE_F_MOVE) : -1;
+
+			if (moved < 0 && errno == EINTR)
+				continue;
+
+			if (moved < 0) {
+				if (spliceable && errno != EINVAL)
+					throw std::runtime_error(pwn::format("Could not splice to fd: {}", to));
+
+				spliceable = false;
+
+				char buffer[chunk];
+				ssize_t received = ::read(relay[0], buffer, std::min(length, sizeof(buffer)));
+				if (received <= 0)
+					throw std::runtime_error("Could not read back the interactive relay pipe");
+
+				write_all(to, buffer, received);
+				moved = received;
+			}
+
+			length -= moved;
+		}
+	}
+public:
+	forwarder(int from, int to): from(from), to(to) {
+		direct = is_pipe(from) || is_pipe(to);
+
+		if (!direct && pipe2(relay, O_CLOEXEC) < 0)
+			spliceable = false;
+	}
+
+	forwarder(const forwarder &) = delete;
+	forwarder &operator=(const forwarder &) = delete;
+
+	~forwarder() {
+		if (relay[0] >= 0) {
+			close(relay[0]);
+			close(relay[1]);
+		}
+	}
+
+	/* moves what from has right now (blocks if that is nothing), false once it reached end of file */
+	bool pump() {
+		if (!spliceable)
+			return impl_copy();
+
+		ssize_t moved = direct ? splice(from, nullptr, to, nullptr, chunk, SPLICE_F_MOVE) :
+			splice(from, nullptr, relay[1], nullptr, chunk, SPLICE_F_MOVE);
+
+		if (moved < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				return true;
+			if (errno != EINVAL)
+				throw std::runtime_error(pwn::format("Could not splice from fd: {}", from));
+
+			spliceable = false;
+			return impl_copy();
+		}
+
+		if (!direct)
+			impl_drain(moved);
+
+		return moved > 0;
+	}
+};
+
+/*
+	Lets the reader of writesock see end of file. A pipe only ends once its write end is closed, /dev/null takes
+	its place so the fd the instance owns stays valid.
+*/
+inline void end_input(int writesock) {
+	if ((shutdown(writesock, SHUT_WR) == 0) || (errno != ENOTSOCK))
+		return;
+
+	int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	if (null < 0)
+		return;
+
+	dup3(null, writesock, O_CLOEXEC);
+	close(null);
+}
+
+/*
+	Forwards input to writesock and readsock to output in the calling thread until readsock reaches end of file,
+	or a terminal user types quit or ends the input. Output is passed on as soon as it arrives, partial lines included.
+	Terminal input is read line by line to see the quit, everything else is spliced. Once other input ran out the
+	write side is shut down and the output still forwarded, so piped commands get their replies.
+*/
+inline void interactive(int readsock, int writesock, int input = STDIN_FILENO, int output = STDOUT_FILENO) {
+	forwarder outgoing(readsock, output);
+	forwarder incoming(input, writesock);
+	bool terminal = isatty(input);
+
+	pollfd fds[2] = {
+		{
+			.fd = readsock,
+			.events = POLLIN,
+			.revents = 0
+		},
+		{
+			.fd = input,
+			.events = POLLIN,
+			.revents = 0
+		}
+	};
+
+	while (true) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			throw std::runtime_error(pwn::format("Could not poll sockid: {}", readsock));
+		}
+
+		if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+			if (!outgoing.pump())
+				return;
+		}
+
+		if (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+			if (!terminal) {
+				if (!incoming.pump()) {
+					fds[1].fd = -1;
+					end_input(writesock);
+				}
+				continue;
+			}
+
+			char line[4096];
+			ssize_t received = ::read(input, line, sizeof(line));
+
+			if (received < 0 && errno == EINTR)
+				continue;
+			if (received <= 0)
+				return;
+
+			std::string_view typed(line, received);
+			if (typed == "quit\n" || typed == "quit")
+				return;
+
+			write_all(writesock, line, received);
+		}
+	}
+}
+
+}
+}
@@ -0,0 +1,196 @@
+#pragma once
+#include <cppwnlib/basic/config.hpp>
+#include <cppwnlib/basic/format.hpp>
+#include <cppwnlib/sockets/instance.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <sys/poll.h>
+#include <sys/socket.h>
+
+namespace pwn {
+
+/*
+	Keeps spares remote instances connected and read up to prompt in background threads, so handing one out
+	costs nothing but a lock. Every instance taken is replaced right away, spares the server closed in the
+	meantime are dropped (checked while idle and again when handing them out).
+
+	pwn::instance_pool<pwn::remote | pwn::bit64> pool("127.0.0.1", 1337, "> ", 16);
+	for (auto &guess : guesses) {
+		auto r = pool.acquire();
+		r->sendline(guess);
+		...
+	}
+*/
+template<int flags>
+class instance_pool {
+	static_assert(flags & pwnflag::remote, "instance_pool only keeps remote instances");
+public:
+	using pointer = std::unique_ptr<pwn::instance<flags>>;
+private:
+	std::string host;
+	int port;
+	std::string prompt;
+	std::size_t spares;
+	std::chrono::milliseconds timeout;
+
+	std::mutex lock;
+	std::condition_variable changed;
+	std::deque<pointer> ready;
+	std::size_t warming = 0;
+	std::size_t failures = 0;
+	std::exception_ptr last_error;
+	bool stopping = false;
+
+	std::vector<std::thread> workers;
+
+	/* whether the server hung up on target, without consuming anything it sent */
+	static bool impl_closed(pwn::instance<flags> &target) {
+		int sockid = target.sb.get_readsock();
+		pollfd fds[1] = {
+			{
+				.fd = sockid,
+				.events = POLLIN | POLLRDHUP,
+				.revents = 0
+			}
+		};
+
+		if (poll(fds, 1, 0) <= 0)
+			return false;
+		if (fds[0].revents & (POLLRDHUP | POLLHUP | POLLERR))
+			return true;
+
+		char byte;
+		return recv(sockid, &byte, 1, MSG_PEEK | MSG_DONTWAIT) == 0;
+	}
+
+	pointer impl_warm() {
+		auto target = std::make_unique<pwn::instance<flags>>(host, port, timeout);
+
+		if (!prompt.empty()) {
+			std::string_view banner = target->recvuntil_view(prompt, std::chrono::steady_clock::now() + timeout);
+			if (!banner.ends_with(prompt))
+				throw std::runtime_error(pwn::format("{}:{} did not send its prompt in time", host, port));
+		}
+
+		/* an io_uring stream belongs to the warming thread, the one using the instance opens its own */
+		target->sb.settle();
+		return target;
+	}
+
+	void impl_prune() {
+		std::erase_if(ready, [](pointer &spare) { return impl_closed(*spare); });
+	}
+
+	void impl_work() {
+		std::unique_lock<std::mutex> guard(lock);
+
+		while (!stopping) {
+			if (ready.size() + warming >= spares) {
+				changed.wait_for(guard, std::chrono::seconds(1));
+				impl_prune();
+				continue;
+			}
+
+			warming++;
+			guard.unlock();
+
+			pointer fresh;
+			std::exception_ptr error;
+			try {
+				fresh = impl_warm();
+			}
+			catch (...) {
+				error = std::current_exception();
+			}
+
+			guard.lock();
+			warming--;
+
+			if (fresh) {
+				ready.push_back(std::move(fresh));
+				failures = 0;
+				last_error = nullptr;
+				changed.notify_all();
+				continue;
+			}
+
+			/* back off while the server refuses, but let acquire see the error right away */
+			last_error = error;
+			failures++;
+			changed.notify_all();
+			changed.wait_for(guard, std::chrono::milliseconds(100) * std::min<std::size_t>(failures, 10));
+		}
+	}
+public:
+	/* timeout bounds connecting and reading the prompt for the spares, and how long acquire waits for one */
+	instance_pool(std::string host, int port, std::string prompt, std::size_t spares = 4,
+		std::chrono::milliseconds timeout = std::chrono::seconds(5)):
+		host(std::move(host)), port(port), prompt(std::move(prompt)), spares(std::max<std::size_t>(spares, 1)), timeout(timeout) {
+		for (std::size_t i = 0; i < std::min<std::size_t>(this->spares, 16); i++)
+			workers.emplace_back(&instance_pool::impl_work, this);
+	}
+
+	instance_pool(const instance_pool &) = delete;
+	instance_pool &operator=(const instance_pool &) = delete;
+
+	~instance_pool() {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+		}
+
+		changed.notify_all();
+		for (auto &worker : workers)
+			worker.join();
+	}
+
+	/*
+		A connected instance which already received the prompt, waiting up to the timeout for one to be ready.
+		If none became ready in time the error which made warming them fail is rethrown.
+	*/
+	pointer acquire() {
+		std::unique_lock<std::mutex> guard(lock);
+		auto until = std::chrono::steady_clock::now() + timeout;
+
+		while (true) {
+			while (!ready.empty()) {
+				pointer spare = std::move(ready.front());
+				ready.pop_front();
+
+				if (!impl_closed(*spare)) {
+					changed.notify_all();
+					return spare;
+				}
+			}
+
+			changed.notify_all();
+
+			if ((changed.wait_until(guard, until) == std::cv_status::timeout) && ready.empty()) {
+				if (last_error)
+					std::rethrow_exception(last_error);
+
+				throw std::runtime_error(pwn::format("No instance of {}:{} became ready in time", host, port));
+			}
+		}
+	}
+
+	/* spares ready to be handed out right now */
+	std::size_t get_ready() {
+		std::lock_guard<std::mutex> guard(lock);
+		return ready.size();
+	}
+};
+
+}
@@ -0,0 +1,192 @@
+#pragma once
+#include <cppwnlib/basic/format.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
+
+namespace pwn {
+
+/* how a local process ended */
+struct exit_status {
+	/* the exit code if it exited, 0 if a signal killed it */
+	int code = 0;
+	/* the signal which killed it, 0 if it exited */
+	int signal = 0;
+	bool core_dumped = false;
+
+	/* from a status as waitpid reports it */
+	static exit_status from_wait(int status) {
+		exit_status result;
+
+		if (WIFSIGNALED(status)) {
+			result.signal = WTERMSIG(status);
+			result.core_dumped = WCOREDUMP(status);
+		}
+		else {
+			result.code = WEXITSTATUS(status);
+		}
+
+		return result;
+	}
+
+	/* from what waitid filled in */
+	static exit_status from_siginfo(const siginfo_t &info) {
+		exit_status result;
+
+		if (info.si_code == CLD_EXITED) {
+			result.code = info.si_status;
+		}
+		else {
+			result.signal = info.si_status;
+			result.core_dumped = info.si_code == CLD_DUMPED;
+		}
+
+		return result;
+	}
+
+	/* killed by a signal which means the program faulted rather than that someone stopped it */
+	bool crashed() const {
+		switch (signal) {
+			case SIGSEGV:
+			case SIGBUS:
+			case SIGILL:
+			case SIGFPE:
+			case SIGABRT:
+			case SIGTRAP:
+			case SIGSYS:
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	std::string describe() const {
+		if (!signal)
+			return pwn::format("exited with {}", code);
+
+		return pwn::format("killed by {}{}", strsignal(signal), core_dumped ? " (core dumped)" : "");
+	}
+};
+
+namespace detail {
+
+/* a pidfd for pid, readable once the process exited. -1 with errno set if there is no such process */
+inline int pidfd_open(pid_t pid) {
+	return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+}
+
+/* unlike kill this never hits another process which got the pid after ours was reaped */
+inline bool pidfd_signal(int pidfd, int sig) {
+	return syscall(SYS_pidfd_send_signal, pidfd, sig, nullptr, 0) == 0;
+}
+
+/* whether waitid reported the end of a process, traced ones also report their stops */
+inline bool is_exit(const siginfo_t &info) {
+	return info.si_pid && ((info.si_code == CLD_EXITED) || (info.si_code == CLD_KILLED) || (info.si_code == CLD_DUMPED));
+}
+
+/* blocks until the child behind pidfd ended and reaps it, skipping stops it reports while being traced */
+inline void pidfd_reap(int pidfd) {
+	while (true) {
+		siginfo_t info {};
+		if (waitid(static_cast<idtype_t>(P_PIDFD), pidfd, &info, WEXITED) < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+
+		if (is_exit(info))
+			return;
+	}
+}
+
+/*
+	Collects the children local instances let go of without killing them. Each is held as a pidfd and reaped once
+	it became readable, which needs neither a SIGCHLD handler nor waitpid(-1) stealing other children's statuses.
+	The pidfds sit in an epoll instance of their own whose fd becomes readable as soon as any of them exited,
+	every pwn::reactor watches it and collects right then. Children are also collected whenever one is handed over
+	and whenever a local instance starts.
+*/
+class reaper {
+private:
+	std::mutex lock;
+	std::vector<int> pidfds;
+	int epfd;
+
+	reaper() {
+		epfd = epoll_create1(EPOLL_CLOEXEC);
+	}
+public:
+	reaper(const reaper &) = delete;
+	reaper &operator=(const reaper &) = delete;
+
+	static reaper &shared() {
+		static reaper instance;
+		return instance;
+	}
+
+	/* readable while an adopted child waits to be collected, -1 if epoll is not available */
+	int get_fd() const {
+		return epfd;
+	}
+
+	/* takes ownership of pidfd, which must belong to a child of ours */
+	void adopt(int pidfd) {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			pidfds.push_back(pidfd);
+
+			if (epfd >= 0) {
+				epoll_event event {};
+				event.events = EPOLLIN;
+				event.data.fd = pidfd;
+				epoll_ctl(epfd, EPOLL_CTL_ADD, pidfd, &event);
+			}
+		}
+
+		collect();
+	}
+
+	/* reaps every adopted child which exited by now, returns how many are still running */
+	std::size_t collect() {
+		std::lock_guard<std::mutex> guard(lock);
+		if (pidfds.empty())
+			return 0;
+
+		std::vector<pollfd> fds;
+		for (int pidfd : pidfds)
+			fds.push_back({.fd = pidfd, .events = POLLIN, .revents = 0});
+
+		if (poll(fds.data(), fds.size(), 0) <= 0)
+			return pidfds.size();
+
+		for (auto &fd : fds) {
+			if (!fd.revents)
+				continue;
+
+			/* closing the last reference also takes it out of the epoll instance */
+			pidfd_reap(fd.fd);
+			close(fd.fd);
+			std::erase(pidfds, fd.fd);
+		}
+
+		return pidfds.size();
+	}
+};
+}
+}
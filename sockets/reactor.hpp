@@ -0,0 +1,761 @@
+#pragma once
+#include <cppwnlib/basic/format.hpp>
+#include <cppwnlib/sockets/process.hpp>
+#include <cppwnlib/sockets/socketbuffer.hpp>
+
+#include <chrono>
+#include <cerrno>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace pwn {
+template<int flags>
+class instance;
+
+class task;
+
+struct timeout_error : std::runtime_error {
+	using std::runtime_error::runtime_error;
+};
+
+/*
+	Drives any number of instances from one thread with an edge triggered epoll.
+	recv, recvuntil, recvline and send queue a step on the instance which runs as soon as its socket is ready,
+	the callback then typically queues the next step. Steps on one instance run in the order they were queued.
+	Registered sockets are made non-blocking, the blocking instance functions keep working on them.
+	Instances unregister themselves when destroyed, they must not outlive the reactor.
+
+	pwn::reactor loop;
+	for (auto &r : remotes)
+		loop.recvuntil(r, "> ", [&](std::string_view) {
+			loop.send(r, "1\n");
+		});
+	loop.run();
+
+	The same loop runs coroutines (pwn::task) which use the async_ functions of instance instead, see spawn.
+*/
+class reactor {
+public:
+	using clock = std::chrono::steady_clock;
+private:
+	/* returns true once it is done, false if it has to wait for its socket to become ready again */
+	using step = std::function<bool()>;
+
+	struct channel {
+		std::deque<step> reads;
+		std::deque<step> writes;
+		bool dispatching = false;
+		bool removed = false;
+		/* timeout timers of the queued steps, cancelled along with the steps when the instance is removed */
+		std::unordered_set<std::uint64_t> deadlines;
+	};
+
+	struct timer {
+		clock::time_point when;
+		std::uint64_t order;
+		std::function<void()> fire;
+
+		bool operator>(const timer &other) const {
+			return when != other.when ? when > other.when : order > other.order;
+		}
+	};
+
+	int epfd;
+	std::unordered_map<int, std::shared_ptr<channel>> channels;
+	std::size_t pending = 0;
+
+	std::priority_queue<timer, std::vector<timer>, std::greater<timer>> timers;
+	std::uint64_t timers_added = 0;
+	/* ids of the timers which will still fire, cancelled ones stay queued until they reach the top and are dropped there */
+	std::unordered_set<std::uint64_t> armed;
+
+	std::size_t tasks = 0;
+	std::exception_ptr failure;
+
+	friend class task;
+
+	static reactor *&current_slot() {
+		static thread_local reactor *current = nullptr;
+		return current;
+	}
+
+	/* makes this the reactor async_ functions of the calling thread use while it is alive */
+	struct activation {
+		reactor *previous;
+
+		activation(reactor *loop): previous(std::exchange(current_slot(), loop)) {}
+		~activation() { current_slot() = previous; }
+	};
+
+	channel &watch(int fd) {
+		auto inserted = channels.try_emplace(fd);
+		if (!inserted.second)
+			return *inserted.first->second;
+
+		int mode = fcntl(fd, F_GETFL);
+		epoll_event event {};
+		event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		event.data.fd = fd;
+
+		if ((mode < 0) || (fcntl(fd, F_SETFL, mode | O_NONBLOCK) < 0) || (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event) < 0)) {
+			channels.erase(inserted.first);
+			throw std::runtime_error(pwn::format("Could not register sockid {} with the reactor", fd));
+		}
+
+		inserted.first->second = std::make_shared<channel>();
+		return *inserted.first->second;
+	}
+
+	/*
+		Runs the steps of queue until one has to wait, returns whether any step finished.
+		The running step is taken out of the queue so it may queue more steps or remove its instance.
+	*/
+	bool run_queue(channel &c, std::deque<step> &queue) {
+		bool progress = false;
+
+		while (!queue.empty() && !c.removed) {
+			step current = std::move(queue.front());
+			queue.pop_front();
+
+			if (!current() && !c.removed) {
+				queue.push_front(std::move(current));
+				break;
+			}
+
+			pending--;
+			progress = true;
+		}
+
+		return progress;
+	}
+
+	void dispatch(int fd) {
+		auto itr = channels.find(fd);
+		if ((itr == channels.end()) || itr->second->dispatching)
+			return;
+
+		/* keeps the channel alive if a step removes it */
+		std::shared_ptr<channel> c = itr->second;
+		c->dispatching = true;
+
+		try {
+			while (run_queue(*c, c->reads) | run_queue(*c, c->writes));
+		}
+		catch (...) {
+			c->dispatching = false;
+			throw;
+		}
+
+		c->dispatching = false;
+	}
+
+	/*
+		Queues next on fd. With a timeout, expired is called instead if next did not finish in time,
+		next is then dropped the next time it would run. With failed, what next throws is handed to it
+		and next counts as finished, otherwise it escapes from poll.
+	*/
+	void queue_step(int fd, bool is_read, step next, std::chrono::milliseconds timeout, std::function<void()> expired,
+		std::function<void(std::exception_ptr)> failed = {}) {
+		channel &c = watch(fd);
+		std::deque<step> &queue = is_read ? c.reads : c.writes;
+		std::weak_ptr<channel> owner = channels[fd];
+
+		if (failed) {
+			next = [failed = std::move(failed), next = std::move(next)]() {
+				try {
+					return next();
+				}
+				catch (...) {
+					failed(std::current_exception());
+					return true;
+				}
+			};
+		}
+
+		if (timeout.count() > 0) {
+			enum class outcome { waiting, finished, expired };
+			auto state = std::make_shared<outcome>(outcome::waiting);
+
+			std::uint64_t deadline = after(timeout, [this, fd, owner, state, expired = std::move(expired)]() {
+				if (*state != outcome::waiting)
+					return;
+
+				*state = outcome::expired;
+
+				/* fd may have been closed and reused by another instance since, only its own channel is run */
+				if (auto c = owner.lock(); c && !c->removed)
+					dispatch(fd);
+				expired();
+			});
+
+			/* a finished step takes its timer along, which would otherwise keep run going until it fired */
+			next = [this, owner, state, deadline, next = std::move(next)]() {
+				if (*state != outcome::expired) {
+					if (!next())
+						return false;
+
+					*state = outcome::finished;
+					cancel(deadline);
+				}
+
+				if (auto c = owner.lock())
+					c->deadlines.erase(deadline);
+				return true;
+			};
+
+			c.deadlines.insert(deadline);
+		}
+
+		queue.push_back(std::move(next));
+		pending++;
+
+		/* with edge triggering nothing wakes up a step queued behind no one, it has to try right away */
+		if (queue.size() == 1)
+			dispatch(fd);
+	}
+
+	template<int flags>
+	detail::SocketBuffer<flags> &attach(instance<flags> &target) {
+		target.loop = this;
+		return target.sb;
+	}
+
+	/* drops cancelled timers from the top of the queue, returns whether any live one is left */
+	bool impl_live_timers() {
+		while (!timers.empty() && !armed.contains(timers.top().order))
+			timers.pop();
+
+		return !timers.empty();
+	}
+
+	std::size_t fire_timers() {
+		std::size_t fired = 0;
+
+		while (impl_live_timers() && (timers.top().when <= clock::now())) {
+			std::function<void()> fire = timers.top().fire;
+			armed.erase(timers.top().order);
+			timers.pop();
+			fire();
+			fired++;
+		}
+
+		return fired;
+	}
+
+	void check_failure() {
+		if (failure)
+			std::rethrow_exception(std::exchange(failure, nullptr));
+	}
+public:
+	reactor() {
+		epfd = epoll_create1(EPOLL_CLOEXEC);
+		if (epfd < 0)
+			throw std::runtime_error("Could not create epoll instance");
+
+		/* children let go of by their instances are collected as they exit, not only when the next one starts */
+		if (int reaped = detail::reaper::shared().get_fd(); reaped >= 0) {
+			epoll_event event {};
+			event.events = EPOLLIN;
+			event.data.fd = reaped;
+			epoll_ctl(epfd, EPOLL_CTL_ADD, reaped, &event);
+		}
+	}
+
+	reactor(const reactor &) = delete;
+	reactor &operator=(const reactor &) = delete;
+
+	~reactor() {
+		close(epfd);
+	}
+
+	/* the reactor running on this thread, the one async_ functions queue their steps on */
+	static reactor &current() {
+		reactor *loop = current_slot();
+		if (!loop)
+			throw std::runtime_error("async functions can only be awaited in a task running on a pwn::reactor");
+
+		return *loop;
+	}
+
+	/* calls fire once timeout has passed, returns an id for cancel */
+	std::uint64_t after(std::chrono::milliseconds timeout, std::function<void()> fire) {
+		timers.push({clock::now() + timeout, timers_added, std::move(fire)});
+		armed.insert(timers_added);
+		return timers_added++;
+	}
+
+	/* keeps the timer id returned by after from firing, nothing happens if it already fired */
+	void cancel(std::uint64_t id) {
+		if (!armed.erase(id))
+			return;
+
+		/* once most queued timers are cancelled ones, e.g. long timeouts of steps which finished quickly, rebuild without them */
+		if ((timers.size() > 64) && (timers.size() > 2 * armed.size())) {
+			std::vector<timer> live;
+			live.reserve(armed.size());
+
+			for (; !timers.empty(); timers.pop())
+				if (armed.contains(timers.top().order))
+					live.push_back(timers.top());
+
+			timers = decltype(timers)(std::greater<timer>(), std::move(live));
+		}
+	}
+
+	/*
+		Calls done with up to length bytes once there are any, an empty view means end of file.
+		Views point into the receive buffer like instance::recv_view.
+	*/
+	template<int flags>
+	void recv(instance<flags> &target, std::size_t length, std::function<void(std::string_view)> done,
+		std::chrono::milliseconds timeout = {}, std::function<void()> expired = {}, std::function<void(std::exception_ptr)> failed = {}) {
+		detail::SocketBuffer<flags> &sb = attach(target);
+
+		queue_step(sb.get_readsock(), true, [&sb, length, done = std::move(done)]() {
+			if (!sb.length() && (sb.try_fill() < 0))
+				return false;
+
+			done(sb.take(length));
+			return true;
+		}, timeout, std::move(expired), std::move(failed));
+	}
+
+	/* calls done with everything up to and including what, or with all that was left on end of file */
+	template<int flags>
+	void recvuntil(instance<flags> &target, std::string_view what, std::function<void(std::string_view)> done,
+		std::chrono::milliseconds timeout = {}, std::function<void()> expired = {}, std::function<void(std::exception_ptr)> failed = {}) {
+		detail::SocketBuffer<flags> &sb = attach(target);
+		auto search = std::make_shared<detail::delimiter_search>(what);
+
+		queue_step(sb.get_readsock(), true, [&sb, search, done = std::move(done)]() {
+			while (true) {
+				std::size_t end = search->next(sb.buffered());
+				if (end != std::string_view::npos) {
+					done(sb.take(end));
+					return true;
+				}
+
+				ssize_t received = sb.try_fill();
+				if (received == 0) {
+					done(sb.take(sb.length()));
+					return true;
+				}
+
+				if (received < 0)
+					return false;
+			}
+		}, timeout, std::move(expired), std::move(failed));
+	}
+
+	template<int flags>
+	void recvline(instance<flags> &target, std::function<void(std::string_view)> done,
+		std::chrono::milliseconds timeout = {}, std::function<void()> expired = {}) {
+		recvuntil(target, "\n", std::move(done), timeout, std::move(expired));
+	}
+
+	/* sends what, possibly over several writes, then calls done */
+	template<int flags>
+	void send(instance<flags> &target, std::string what, std::function<void()> done = {},
+		std::chrono::milliseconds timeout = {}, std::function<void()> expired = {}, std::function<void(std::exception_ptr)> failed = {}) {
+		detail::SocketBuffer<flags> &sb = attach(target);
+		auto data = std::make_shared<std::string>(std::move(what));
+		auto sent = std::make_shared<std::size_t>(0);
+
+		queue_step(sb.get_writesock(), false, [&sb, data, sent, done = std::move(done)]() {
+			while (*sent < data->length()) {
+				ssize_t written = sb.try_write(data->data() + *sent, data->length() - *sent);
+				if (written < 0)
+					return false;
+
+				*sent += written;
+			}
+
+			if (done)
+				done();
+			return true;
+		}, timeout, std::move(expired), std::move(failed));
+	}
+
+	template<int flags>
+	void sendline(instance<flags> &target, std::string_view what, std::function<void()> done = {}) {
+		std::string line;
+		line.reserve(what.length() + 1);
+		line.append(what.data(), what.length());
+		line += '\n';
+
+		send(target, std::move(line), std::move(done));
+	}
+
+	/* calls done once the connect of target's socket finished, with 0 or the errno it failed with */
+	template<int flags>
+	void connected(instance<flags> &target, std::function<void(int)> done,
+		std::chrono::milliseconds timeout = {}, std::function<void()> expired = {}) {
+		detail::SocketBuffer<flags> &sb = attach(target);
+
+		queue_step(sb.get_writesock(), false, [&sb, done = std::move(done)]() {
+			if (!detail::socket_wait(sb.get_writesock(), POLLOUT, 0))
+				return false;
+
+			int error = 0;
+			socklen_t length = sizeof(error);
+			if (getsockopt(sb.get_writesock(), SOL_SOCKET, SO_ERROR, &error, &length) < 0)
+				error = errno;
+
+			done(error);
+			return true;
+		}, timeout, std::move(expired));
+	}
+
+	/*
+		Calls done with the exit status of target's process once it ended, woken up by its pidfd.
+		Throws for instances without a process.
+	*/
+	template<int flags>
+	void exited(instance<flags> &target, std::function<void(const pwn::exit_status &)> done,
+		std::chrono::milliseconds timeout = {}, std::function<void()> expired = {}) {
+		if (target.get_pid() <= 0)
+			throw std::runtime_error("Only local instances have a process to wait for");
+
+		/* without a pidfd the process was already reaped by its fork server */
+		if (target.get_pidfd() < 0) {
+			std::optional<pwn::exit_status> status = target.wait();
+			if (status)
+				done(*status);
+			return;
+		}
+
+		attach(target);
+
+		queue_step(target.get_pidfd(), true, [&target, done = std::move(done)]() {
+			std::optional<pwn::exit_status> status = target.wait(clock::now());
+			if (!status)
+				return false;
+
+			done(*status);
+			return true;
+		}, timeout, std::move(expired));
+	}
+
+	/* drops every step queued on target and stops watching its sockets, called when an instance is destroyed */
+	template<int flags>
+	void remove(instance<flags> &target) {
+		for (int fd : {target.sb.get_readsock(), target.sb.get_writesock(), target.pidfd}) {
+			auto itr = channels.find(fd);
+			if (itr == channels.end())
+				continue;
+
+			channel &c = *itr->second;
+			pending -= c.reads.size() + c.writes.size();
+			c.reads.clear();
+			c.writes.clear();
+			c.removed = true;
+
+			for (std::uint64_t deadline : c.deadlines)
+				cancel(deadline);
+			c.deadlines.clear();
+
+			epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+			channels.erase(itr);
+		}
+
+		target.loop = nullptr;
+	}
+
+	/* starts running t on this reactor, exceptions escaping it are rethrown from poll or run */
+	void spawn(task t);
+
+	/*
+		Runs t up to its first wait without detaching it. The caller keeps t, sees with task::done when it finished
+		and may destroy it before that to cancel it.
+	*/
+	void start(task &t);
+
+	/*
+		Waits up to timeout ms (-1 forever) for sockets to become ready or timers to expire and runs their steps,
+		false if nothing happened.
+	*/
+	bool poll(int timeout = -1) {
+		activation active(this);
+
+		if (impl_live_timers()) {
+			auto until_timer = std::chrono::ceil<std::chrono::milliseconds>(timers.top().when - clock::now()).count();
+			until_timer = std::max<decltype(until_timer)>(until_timer, 0);
+
+			if ((timeout < 0) || (until_timer < timeout))
+				timeout = until_timer;
+		}
+
+		epoll_event events[256];
+		int ready = epoll_wait(epfd, events, std::size(events), timeout);
+
+		if (ready < 0) {
+			if (errno == EINTR)
+				return true;
+			throw std::runtime_error("epoll_wait failed");
+		}
+
+		for (int i = 0; i < ready; i++) {
+			if (events[i].data.fd == detail::reaper::shared().get_fd())
+				detail::reaper::shared().collect();
+			else
+				dispatch(events[i].data.fd);
+		}
+
+		std::size_t fired = fire_timers();
+
+		check_failure();
+		return (ready > 0) || fired;
+	}
+
+	/* runs until no step, timer or task is left */
+	void run() {
+		check_failure();
+
+		while (pending || impl_live_timers() || tasks)
+			poll();
+	}
+
+	std::size_t get_pending() const {
+		return pending;
+	}
+};
+
+/*
+	A coroutine running on a pwn::reactor. Tasks start suspended, they either run detached with reactor::spawn
+	or as part of another task with co_await, which rethrows what escaped them.
+
+	pwn::task exploit(pwn::instance<pwn::remote | pwn::bit64> &r) {
+		co_await r.async_recvuntil("> ");
+		co_await r.async_sendline("1");
+		std::string leak = co_await r.async_recvline(std::chrono::seconds(1));
+	}
+
+	loop.spawn(exploit(r));
+	loop.run();
+*/
+class task {
+public:
+	struct promise_type {
+		std::coroutine_handle<> continuation;
+		std::exception_ptr error;
+		reactor *owner = nullptr;
+
+		task get_return_object() {
+			return task(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+
+		std::suspend_always initial_suspend() noexcept {
+			return {};
+		}
+
+		auto final_suspend() noexcept {
+			struct final_awaiter {
+				bool await_ready() noexcept {
+					return false;
+				}
+
+				std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+					promise_type &promise = handle.promise();
+
+					if (promise.continuation)
+						return promise.continuation;
+
+					/* started with reactor::start, the task object destroys the frame */
+					if (!promise.owner)
+						return std::noop_coroutine();
+
+					/* detached, nobody else is left to destroy the frame */
+					if (promise.owner) {
+						promise.owner->tasks--;
+						if (promise.error && !promise.owner->failure)
+							promise.owner->failure = promise.error;
+					}
+
+					handle.destroy();
+					return std::noop_coroutine();
+				}
+
+				void await_resume() noexcept {}
+			};
+
+			return final_awaiter {};
+		}
+
+		void return_void() {}
+
+		void unhandled_exception() {
+			error = std::current_exception();
+		}
+	};
+private:
+	std::coroutine_handle<promise_type> handle;
+
+	friend class reactor;
+public:
+	explicit task(std::coroutine_handle<promise_type> handle): handle(handle) {}
+
+	task(task &&other): handle(std::exchange(other.handle, nullptr)) {}
+	task(const task &) = delete;
+
+	~task() {
+		if (handle)
+			handle.destroy();
+	}
+
+	bool done() const {
+		return !handle || handle.done();
+	}
+
+	/* what escaped the task once it is done, nullptr if nothing did */
+	std::exception_ptr get_error() const {
+		return handle ? handle.promise().error : nullptr;
+	}
+
+	auto operator co_await() && {
+		struct awaiter {
+			std::coroutine_handle<promise_type> handle;
+
+			bool await_ready() {
+				return false;
+			}
+
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) {
+				handle.promise().continuation = caller;
+				return handle;
+			}
+
+			void await_resume() {
+				if (handle.promise().error)
+					std::rethrow_exception(handle.promise().error);
+			}
+		};
+
+		return awaiter {handle};
+	}
+};
+
+inline void reactor::spawn(task t) {
+	std::coroutine_handle<task::promise_type> handle = std::exchange(t.handle, nullptr);
+	handle.promise().owner = this;
+	tasks++;
+
+	{
+		activation active(this);
+		handle.resume();
+	}
+
+	check_failure();
+}
+
+inline void reactor::start(task &t) {
+	activation active(this);
+	t.handle.resume();
+}
+
+namespace detail {
+	/*
+		Awaitable around a reactor step: start queues the step with a callback delivering the result,
+		one for its timeout and one for an error the step threw, which is rethrown in the task. Steps which
+		finish right away do not suspend, so a task reading many buffered lines does not recurse.
+		The callbacks do nothing once the awaitable is gone with its cancelled task.
+	*/
+	template<typename Result>
+	class reactor_awaitable {
+	public:
+		using deliver = std::function<void(Result)>;
+		using starter = std::function<void(reactor &, deliver, std::function<void()>, std::function<void(std::exception_ptr)>)>;
+	private:
+		starter start;
+		std::optional<Result> result;
+		std::exception_ptr error;
+		bool timed_out = false;
+		bool suspending = false;
+		std::coroutine_handle<> handle;
+		std::shared_ptr<bool> alive = std::make_shared<bool>(true);
+
+		void complete() {
+			if (!suspending)
+				handle.resume();
+		}
+	public:
+		reactor_awaitable(starter start): start(std::move(start)) {}
+
+		reactor_awaitable(const reactor_awaitable &) = delete;
+		reactor_awaitable &operator=(const reactor_awaitable &) = delete;
+
+		~reactor_awaitable() {
+			*alive = false;
+		}
+
+		bool await_ready() {
+			return false;
+		}
+
+		bool await_suspend(std::coroutine_handle<> caller) {
+			handle = caller;
+			suspending = true;
+
+			start(reactor::current(), [this, alive = alive](Result value) {
+				if (!*alive)
+					return;
+
+				result = std::move(value);
+				complete();
+			}, [this, alive = alive]() {
+				if (!*alive)
+					return;
+
+				timed_out = true;
+				complete();
+			}, [this, alive = alive](std::exception_ptr failure) {
+				if (!*alive)
+					return;
+
+				error = failure;
+				complete();
+			});
+
+			suspending = false;
+			return !(result || timed_out || error);
+		}
+
+		Result await_resume() {
+			if (error)
+				std::rethrow_exception(error);
+			if (timed_out)
+				throw timeout_error("Timed out waiting on instance");
+
+			return std::move(*result);
+		}
+	};
+
+	/* Result for steps without one */
+	struct done {};
+}
+
+/* suspends the calling task for duration without blocking the reactor */
+inline detail::reactor_awaitable<detail::done> async_sleep(std::chrono::milliseconds duration) {
+	return detail::reactor_awaitable<detail::done>([duration](reactor &loop, auto deliver, auto, auto) {
+		loop.after(duration, [deliver]() { deliver({}); });
+	});
+}
+
+}
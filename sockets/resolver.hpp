@@ -0,0 +1,286 @@
+#pragma once
+#include <cppwnlib/basic/format.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace pwn {
+
+/* one address a host resolved to, IPv4 or IPv6 */
+struct endpoint {
+	sockaddr_storage address {};
+	socklen_t length = 0;
+
+	int family() const {
+		return address.ss_family;
+	}
+
+	/* the address in numeric form, e.g. 127.0.0.1 or ::1 */
+	std::string ip() const {
+		char text[INET6_ADDRSTRLEN] = {0};
+		const void *raw = family() == AF_INET6 ?
+			static_cast<const void *>(&reinterpret_cast<const sockaddr_in6 *>(&address)->sin6_addr) :
+			static_cast<const void *>(&reinterpret_cast<const sockaddr_in *>(&address)->sin_addr);
+
+		return inet_ntop(family(), raw, text, sizeof(text)) ? text : "";
+	}
+};
+
+/*
+	Caches what getaddrinfo resolved host and port to for ttl, shared by all remote instances of the process.
+	getaddrinfo does not tell the TTL of the records, so entries live for a fixed time instead (60 s by default).
+	Threads asking for a name which is being resolved wait for that lookup instead of starting their own.
+	Endpoints are ordered for Happy Eyeballs, alternating between the address families starting with the preferred one.
+*/
+class resolver {
+private:
+	using clock = std::chrono::steady_clock;
+
+	struct entry {
+		std::vector<pwn::endpoint> endpoints;
+		clock::time_point expires;
+		bool resolving = false;
+	};
+
+	std::mutex lock;
+	std::condition_variable resolved;
+	std::unordered_map<std::string, entry> cache;
+	std::chrono::seconds ttl {60};
+
+	/* RFC 8305 interleaving: the first family getaddrinfo preferred, then the other one, and so on */
+	static std::vector<pwn::endpoint> interleave(std::vector<pwn::endpoint> found) {
+		if (found.empty())
+			return found;
+
+		std::vector<pwn::endpoint> preferred, other, ordered;
+		for (auto &e : found)
+			(e.family() == found.front().family() ? preferred : other).push_back(e);
+
+		for (std::size_t i = 0; i < std::max(preferred.size(), other.size()); i++) {
+			if (i < preferred.size())
+				ordered.push_back(preferred[i]);
+			if (i < other.size())
+				ordered.push_back(other[i]);
+		}
+
+		return ordered;
+	}
+
+	static std::vector<pwn::endpoint> lookup(const std::string &host, int port) {
+		addrinfo hints {};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_protocol = IPPROTO_TCP;
+
+		addrinfo *found = nullptr;
+		if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &found) || !found)
+			throw std::runtime_error(pwn::format("Could not get host {} by name", host));
+
+		std::vector<pwn::endpoint> endpoints;
+		for (addrinfo *itr = found; itr; itr = itr->ai_next) {
+			if ((itr->ai_family != AF_INET) && (itr->ai_family != AF_INET6))
+				continue;
+
+			pwn::endpoint e;
+			std::memcpy(&e.address, itr->ai_addr, itr->ai_addrlen);
+			e.length = itr->ai_addrlen;
+			endpoints.push_back(e);
+		}
+
+		freeaddrinfo(found);
+
+		if (endpoints.empty())
+			throw std::runtime_error(pwn::format("Could not deduce ip from {}", host));
+
+		return interleave(std::move(endpoints));
+	}
+public:
+	/* the resolver remote instances use */
+	static resolver &shared() {
+		static resolver instance;
+		return instance;
+	}
+
+	std::vector<pwn::endpoint> resolve(const std::string &host, int port) {
+		std::string key = pwn::format("{}:{}", host, port);
+		std::unique_lock<std::mutex> guard(lock);
+
+		while (true) {
+			auto itr = cache.find(key);
+			if (itr == cache.end())
+				break;
+
+			if (itr->second.resolving) {
+				resolved.wait(guard);
+				continue;
+			}
+
+			if (clock::now() < itr->second.expires)
+				return itr->second.endpoints;
+
+			break;
+		}
+
+		cache[key].resolving = true;
+		guard.unlock();
+
+		std::vector<pwn::endpoint> endpoints;
+		try {
+			endpoints = lookup(host, port);
+		}
+		catch (...) {
+			guard.lock();
+			cache.erase(key);
+			resolved.notify_all();
+			throw;
+		}
+
+		guard.lock();
+		entry &e = cache[key];
+		e.endpoints = endpoints;
+		e.expires = clock::now() + ttl;
+		e.resolving = false;
+		resolved.notify_all();
+
+		return endpoints;
+	}
+
+	void set_ttl(std::chrono::seconds seconds) {
+		std::lock_guard<std::mutex> guard(lock);
+		ttl = seconds;
+	}
+
+	/* forgets every cached name, e.g. after the target moved */
+	void flush() {
+		std::lock_guard<std::mutex> guard(lock);
+		std::erase_if(cache, [](auto &item) { return !item.second.resolving; });
+	}
+};
+
+namespace detail {
+
+/*
+	Happy Eyeballs (RFC 8305): connects to the endpoints in order, starting the next attempt whenever the running ones
+	have not succeeded within 250 ms or one of them failed, and keeps the first connection which is established.
+	Everything is given up after timeout (none if it is not positive). Returns the connected, blocking socket and
+	sets chosen to its endpoint, or -1 with errno set (ETIMEDOUT if the time ran out).
+*/
+inline int connect_any(const std::vector<pwn::endpoint> &endpoints, std::chrono::milliseconds timeout, pwn::endpoint *chosen = nullptr) {
+	using clock = std::chrono::steady_clock;
+	constexpr std::chrono::milliseconds attempt_delay(250);
+
+	clock::time_point until = timeout.count() > 0 ? clock::now() + timeout : clock::time_point::max();
+	clock::time_point next_start = clock::now();
+	std::size_t next = 0;
+	int last_error = ECONNREFUSED;
+
+	std::vector<pollfd> pending;
+	std::vector<std::size_t> attempted;
+
+	auto give_up = [&](int error) {
+		for (auto &p : pending)
+			close(p.fd);
+
+		errno = error;
+		return -1;
+	};
+
+	auto won = [&](int sockid, std::size_t index) {
+		for (auto &p : pending) {
+			if (p.fd != sockid)
+				close(p.fd);
+		}
+
+		fcntl(sockid, F_SETFL, fcntl(sockid, F_GETFL) & ~O_NONBLOCK);
+
+		if (chosen)
+			*chosen = endpoints[index];
+		return sockid;
+	};
+
+	while (true) {
+		clock::time_point now = clock::now();
+
+		if ((next < endpoints.size()) && (pending.empty() || (now >= next_start))) {
+			const pwn::endpoint &e = endpoints[next];
+			int sockid = socket(e.family(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+			if (sockid >= 0) {
+				if (connect(sockid, reinterpret_cast<const sockaddr *>(&e.address), e.length) == 0)
+					return won(sockid, next);
+
+				if (errno == EINPROGRESS) {
+					pending.push_back({.fd = sockid, .events = POLLOUT, .revents = 0});
+					attempted.push_back(next);
+				}
+				else {
+					last_error = errno;
+					close(sockid);
+				}
+			}
+			else {
+				last_error = errno;
+			}
+
+			next++;
+			next_start = pending.empty() ? now : now + attempt_delay;
+			continue;
+		}
+
+		if (pending.empty())
+			return give_up(last_error);
+
+		if (now >= until)
+			return give_up(ETIMEDOUT);
+
+		clock::time_point wake = std::min(until, next < endpoints.size() ? next_start : clock::time_point::max());
+		auto remaining = std::chrono::ceil<std::chrono::milliseconds>(wake - now).count();
+
+		if (poll(pending.data(), pending.size(), static_cast<int>(std::min<decltype(remaining)>(remaining, INT32_MAX))) < 0) {
+			if (errno == EINTR)
+				continue;
+			return give_up(errno);
+		}
+
+		for (std::size_t i = 0; i < pending.size();) {
+			if (!pending[i].revents) {
+				i++;
+				continue;
+			}
+
+			int error = 0;
+			socklen_t length = sizeof(error);
+			if (getsockopt(pending[i].fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0)
+				error = errno;
+
+			if (!error)
+				return won(pending[i].fd, attempted[i]);
+
+			/* a failed attempt lets the next one start right away */
+			last_error = error;
+			close(pending[i].fd);
+			pending.erase(pending.begin() + i);
+			attempted.erase(attempted.begin() + i);
+			next_start = clock::now();
+		}
+	}
+}
+
+}
+}
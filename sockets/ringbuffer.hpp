@@ -0,0 +1,229 @@
+#pragma once
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace pwn {
+namespace detail {
+
+/*
+	Byte ring with a power of two capacity. Consuming, peeking and unreading only move the read offset,
+	the buffered bytes themselves stay where they were written.
+	When possible the storage is mapped twice back to back (a memfd mapped at both halves of a reservation),
+	so the buffered bytes are always contiguous in memory and peek never copies. Otherwise a wrapped ring
+	is rotated to the front of its storage the first time a contiguous view of it is needed.
+*/
+class ring_buffer {
+private:
+	char *storage = nullptr;
+	std::size_t capacity = 0;
+	std::size_t head = 0;
+	std::size_t count = 0;
+	bool mirrored = false;
+
+	static char *map_mirrored(std::size_t size) {
+		if (size % sysconf(_SC_PAGESIZE))
+			return nullptr;
+
+		int fd = memfd_create("cppwnlib-ring", MFD_CLOEXEC);
+		if (fd < 0)
+			return nullptr;
+
+		void *base = MAP_FAILED;
+		if (ftruncate(fd, size) == 0)
+			base = mmap(nullptr, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if (base != MAP_FAILED) {
+			char *low = static_cast<char *>(base);
+
+			if ((mmap(low, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) ||
+				(mmap(low + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)) {
+				munmap(base, 2 * size);
+				base = MAP_FAILED;
+			}
+		}
+
+		close(fd);
+		return base == MAP_FAILED ? nullptr : static_cast<char *>(base);
+	}
+
+	void release() {
+		if (mirrored)
+			munmap(storage, 2 * capacity);
+		else
+			delete[] storage;
+
+		storage = nullptr;
+	}
+
+	/* moves the buffered bytes to new storage of size bytes, starting at offset 0 */
+	void reallocate(std::size_t size) {
+		char *fresh = map_mirrored(size);
+		bool fresh_mirrored = fresh != nullptr;
+
+		if (!fresh)
+			fresh = new char[size];
+
+		std::size_t first = std::min(count, capacity - head);
+		if (count) {
+			std::memcpy(fresh, storage + head, first);
+			std::memcpy(fresh + first, storage, count - first);
+		}
+
+		release();
+
+		storage = fresh;
+		capacity = size;
+		mirrored = fresh_mirrored;
+		head = 0;
+	}
+
+	std::size_t tail() const {
+		return (head + count) & (capacity - 1);
+	}
+public:
+	ring_buffer(std::size_t initial = 1 << 16) {
+		std::size_t size = 1;
+		while (size < initial)
+			size <<= 1;
+
+		reallocate(size);
+	}
+
+	ring_buffer(const ring_buffer &) = delete;
+	ring_buffer &operator=(const ring_buffer &) = delete;
+
+	ring_buffer(ring_buffer &&other) {
+		*this = std::move(other);
+	}
+
+	ring_buffer &operator=(ring_buffer &&other) {
+		if (this != &other) {
+			release();
+
+			storage = std::exchange(other.storage, nullptr);
+			capacity = std::exchange(other.capacity, 0);
+			head = std::exchange(other.head, 0);
+			count = std::exchange(other.count, 0);
+			mirrored = std::exchange(other.mirrored, false);
+		}
+
+		return *this;
+	}
+
+	~ring_buffer() {
+		release();
+	}
+
+	std::size_t size() const {
+		return count;
+	}
+
+	bool empty() const {
+		return count == 0;
+	}
+
+	/* make room for at least n more bytes */
+	void reserve(std::size_t n) {
+		if (capacity - count >= n)
+			return;
+
+		std::size_t size = capacity ? capacity : 1;
+		while (size - count < n)
+			size <<= 1;
+
+		reallocate(size);
+	}
+
+	/* the first n buffered bytes (all of them by default) as one contiguous view, valid until the next modification */
+	std::string_view peek(std::size_t n = -1) {
+		n = std::min(n, count);
+
+		if (!mirrored && head + n > capacity) {
+			std::rotate(storage, storage + head, storage + capacity);
+			head = 0;
+		}
+
+		return std::string_view(storage + head, n);
+	}
+
+	void consume(std::size_t n) {
+		n = std::min(n, count);
+
+		head = (head + n) & (capacity - 1);
+		count -= n;
+
+		if (!count)
+			head = 0;
+	}
+
+	/*
+		Consumes up to n bytes and returns a view of them. Consumed bytes are not overwritten until
+		the next fill or unread, so the view stays valid until then.
+	*/
+	std::string_view take(std::size_t n) {
+		std::string_view part = peek(n);
+		consume(part.length());
+
+		return part;
+	}
+
+	/* appends what behind the buffered bytes */
+	void append(std::string_view what) {
+		reserve(what.length());
+
+		std::size_t first = std::min(what.length(), capacity - tail());
+		std::memcpy(storage + tail(), what.data(), first);
+		std::memcpy(storage, what.data() + first, what.length() - first);
+
+		count += what.length();
+	}
+
+	/* puts what back in front of the buffered bytes */
+	void unread(std::string_view what) {
+		reserve(what.length());
+
+		head = (head - what.length()) & (capacity - 1);
+		count += what.length();
+
+		std::size_t first = std::min(what.length(), capacity - head);
+		std::memcpy(storage + head, what.data(), first);
+		std::memcpy(storage, what.data() + first, what.length() - first);
+	}
+
+	/*
+		Reads from fd into the free space with a single readv, growing the ring first so everything the kernel
+		has buffered (FIONREAD) fits, but by at least min_space bytes. Returns what readv returned.
+	*/
+	ssize_t fill(int fd, std::size_t min_space = 4096) {
+		int available = 0;
+		if (ioctl(fd, FIONREAD, &available) < 0)
+			available = 0;
+
+		reserve(std::max<std::size_t>(available, min_space));
+
+		std::size_t free_space = capacity - count;
+		std::size_t first = std::min(free_space, capacity - tail());
+
+		iovec parts[2] = {
+			{storage + tail(), first},
+			{storage, free_space - first}
+		};
+
+		ssize_t received = readv(fd, parts, parts[1].iov_len ? 2 : 1);
+		if (received > 0)
+			count += received;
+
+		return received;
+	}
+};
+
+}
+}
@@ -1,15 +1,50 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <functional>
+#include <initializer_list>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <sys/poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <cppwnlib/basic/config.hpp>
+#include <cppwnlib/basic/format.hpp>
+#include <cppwnlib/sockets/ringbuffer.hpp>
+#include <cppwnlib/sockets/uring.hpp>
 #include <unistd.h>
 
 namespace pwn {
+/* absolute point in time a receive gives up at, on the monotonic clock. deadline::max() is none */
+using deadline = std::chrono::steady_clock::time_point;
+
+/*
+	How the waits for input of an instance went, only waits with a deadline are counted.
+	longest is the longest wait which still got data in time and overshoot how far past its deadline a timed out
+	wait returned at worst, together they tell how tight a race window can be made.
+*/
+struct timeout_stats {
+	std::size_t waits = 0;
+	std::size_t timeouts = 0;
+	std::chrono::nanoseconds waited {0};
+	std::chrono::nanoseconds longest {0};
+	std::chrono::nanoseconds overshoot {0};
+};
+
 namespace detail {
-bool socket_has_input(int sockid, int timeout) {
+/* waits until sockid has one of events, false on timeout */
+inline bool socket_wait(int sockid, short events, int timeout) {
     	pollfd fds[1] = {
         	{
 			.fd = sockid,
-			.events = POLLIN
+			.events = events,
+			.revents = 0
 		}
     	};
 
@@ -18,60 +53,446 @@ bool socket_has_input(int sockid, int timeout) {
 	if (status == -1)
 		throw std::runtime_error(pwn::format("Could not poll sockid: {}", sockid));
 
-	return fds[0].revents & POLLIN;
+	return fds[0].revents & events;
+}
+
+bool socket_has_input(int sockid, int timeout) {
+	return socket_wait(sockid, POLLIN, timeout);
+}
+
+/*
+	Waits until sockid has one of events, hung up or failed, with a single ppoll for the time left until the deadline.
+	False if the deadline passed first, a deadline in the past still reports events which are already there.
+*/
+inline bool socket_wait_until(int sockid, short events, deadline until) {
+	pollfd fds[1] = {
+		{
+			.fd = sockid,
+			.events = events,
+			.revents = 0
+		}
+	};
+
+	while (true) {
+		auto remaining = std::max<std::chrono::nanoseconds>(until - std::chrono::steady_clock::now(), std::chrono::nanoseconds::zero());
+		timespec ts {
+			.tv_sec = static_cast<time_t>(remaining.count() / 1000000000),
+			.tv_nsec = static_cast<long>(remaining.count() % 1000000000)
+		};
+
+		int status = ppoll(fds, 1, &ts, nullptr);
+
+		if (status >= 0)
+			return fds[0].revents & (events | POLLHUP | POLLERR);
+		if (errno != EINTR)
+			throw std::runtime_error(pwn::format("Could not poll sockid: {}", sockid));
+	}
 }
 
+/*
+	Incremental search for a delimiter in a growing buffer. Each call is given the whole buffer again,
+	with new data appended, and only looks at what it has not seen yet (plus the length of the delimiter
+	minus one, in case it was split). Single bytes are found with memchr and longer delimiters with Horspool.
+*/
+class delimiter_search {
+private:
+	std::string delimiter;
+	std::boyer_moore_horspool_searcher<std::string::const_iterator> search;
+	std::size_t scanned = 0;
+public:
+	delimiter_search(std::string_view delimiter): delimiter(delimiter), search(this->delimiter.begin(), this->delimiter.end()) {}
+
+	delimiter_search(const delimiter_search &) = delete;
+	delimiter_search &operator=(const delimiter_search &) = delete;
+
+	/* offset just past the first occurrence of the delimiter in data, npos if there is none yet */
+	std::size_t next(std::string_view data) {
+		if (delimiter.empty())
+			return 0;
+
+		std::size_t from = scanned - std::min(scanned, delimiter.length() - 1);
+		scanned = data.length();
+
+		if (delimiter.length() == 1) {
+			const void *hit = std::memchr(data.data() + from, delimiter[0], data.length() - from);
+			if (hit)
+				return static_cast<const char *>(hit) - data.data() + 1;
+		}
+		else {
+			auto hit = std::search(data.begin() + from, data.end(), search);
+			if (hit != data.end())
+				return hit - data.begin() + delimiter.length();
+		}
+
+		return std::string_view::npos;
+	}
+};
+
 template<int flags = 0>
 class SocketBuffer {
 private:
-	int timeout = 100;
-	int readsock, writesock;
-	std::string buffer;
+	/* ms each receive call may take without an explicit deadline, negative for no limit */
+	int timeout = (flags & noblocking) ? 100 : -1;
+	int readsock = -1, writesock = -1;
+	ring_buffer buffer;
+	std::string queued;
+	bool corked = false;
+	bool is_pipe = false;
+	pwn::timeout_stats stats;
+
+	/* with pwn::uring, created on first use. Stays empty if the kernel has no usable io_uring */
+	std::unique_ptr<uring_stream, uring_stream::release> stream;
+	bool uring_unavailable = false;
+
+	uring_stream *impl_stream() {
+		if constexpr (!(flags & pwnflag::uring)) {
+			return nullptr;
+		}
+		else {
+			if (!stream && !uring_unavailable) {
+				uring *ring = uring::get();
+
+				if (ring)
+					stream.reset(ring->open(readsock, writesock));
+				else
+					uring_unavailable = true;
+			}
+
+			if (stream)
+				stream->target = &buffer;
 
-	std::string impl_readb(const std::size_t n = 1024) {
-		if (buffer.length() < n) {
-			auto partial_buffer = new char[n]();
-			
-			::read(readsock, partial_buffer, n - buffer.length() - 1);
-			buffer += std::string(partial_buffer);
-			free(partial_buffer);
+			return stream.get();
 		}
+	}
+
+	void impl_check(uring_stream *s) {
+		if (s->error)
+			throw std::runtime_error(pwn::format("io_uring request on sockid {} failed with errno {}", readsock, s->error));
+	}
+
+	/* writev until every piece is out, resuming after short writes. Sockets use sendmsg to avoid SIGPIPE like try_write */
+	void impl_writev(iovec *parts, std::size_t count) {
+		while (count) {
+			ssize_t written;
+
+			if (is_pipe) {
+				written = ::writev(writesock, parts, std::min<std::size_t>(count, IOV_MAX));
+			}
+			else {
+				msghdr message {};
+				message.msg_iov = parts;
+				message.msg_iovlen = std::min<std::size_t>(count, IOV_MAX);
+				written = ::sendmsg(writesock, &message, MSG_NOSIGNAL);
+			}
+
+			if (written < 0) {
+				if (errno == ENOTSOCK)
+					is_pipe = true;
+				else if (errno == EAGAIN || errno == EWOULDBLOCK)
+					socket_wait(writesock, POLLOUT, -1);
+				else if (errno != EINTR)
+					throw std::runtime_error(pwn::format("Could not write to sockid: {}", writesock));
+				continue;
+			}
+
+			while (count && static_cast<std::size_t>(written) >= parts->iov_len) {
+				written -= parts->iov_len;
+				parts++;
+				count--;
+			}
+
+			if (count) {
+				parts->iov_base = static_cast<char *>(parts->iov_base) + written;
+				parts->iov_len -= written;
+			}
+		}
+	}
+
+	bool set_tcp_option(int option, bool enable) {
+		int value = enable;
+		return setsockopt(writesock, IPPROTO_TCP, option, &value, sizeof(value)) == 0;
+	}
+
+	deadline default_deadline() const {
+		if (timeout < 0)
+			return deadline::max();
+
+		return std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+	}
+
+	/*
+		One read of everything the kernel has for us, waiting for it until the deadline with a single poll
+		(or none at all without a deadline, the read blocks then). 0 on end of file, -1 if the deadline passed.
+	*/
+	ssize_t impl_receive(std::size_t min_read, deadline until) {
+		bool bounded = until != deadline::max();
 
-		std::string part = buffer.substr(0, n);
-		buffer.erase(0, std::min(buffer.length(), n));
+		if (uring_stream *s = impl_stream()) {
+			std::size_t have = buffer.size();
+			bool arrived = s->ring.wait(s, have, until);
+			impl_check(s);
 
-		return part;
+			return arrived ? buffer.size() - have : -1;
+		}
+
+		while (true) {
+			if (bounded && !socket_wait_until(readsock, POLLIN, until))
+				return -1;
+
+			ssize_t received = try_fill(min_read);
+			if (received >= 0)
+				return received;
+
+			/* the socket was made non-blocking by a reactor */
+			if (!bounded)
+				socket_wait(readsock, POLLIN, -1);
+		}
+	}
+
+	ssize_t impl_fill(std::size_t min_read, deadline until) {
+		if (until == deadline::max())
+			return impl_receive(min_read, until);
+
+		deadline start = std::chrono::steady_clock::now();
+		ssize_t received = impl_receive(min_read, until);
+		deadline now = std::chrono::steady_clock::now();
+
+		stats.waits++;
+		stats.waited += now - start;
+
+		if (received >= 0) {
+			stats.longest = std::max<std::chrono::nanoseconds>(stats.longest, now - start);
+		}
+		else {
+			stats.timeouts++;
+			stats.overshoot = std::max<std::chrono::nanoseconds>(stats.overshoot, now - until);
+		}
+
+		return received;
 	}
 	
 public:
 	SocketBuffer() {}
-	SocketBuffer(int sockid): readsock(sockid), writesock(sockid), buffer("") {}
-	SocketBuffer(int readid, int writeid): readsock(readid), writesock(writeid), buffer("") {}
+	SocketBuffer(int sockid): readsock(sockid), writesock(sockid) {}
+	SocketBuffer(int readid, int writeid): readsock(readid), writesock(writeid) {}
+
+	/*
+		Up to n bytes, only touching the socket when nothing is buffered. Empty on end of file or if nothing came
+		before the deadline, which is the configured timeout from now if none is given.
+		The view points into the buffer and stays valid until the next read or unread.
+	*/
+	std::string_view read_view(std::size_t n, deadline until) {
+		if (buffer.empty())
+			impl_fill(4096, until);
+
+		return buffer.take(n);
+	}
+
+	std::string_view read_view(std::size_t n = 1024) {
+		return read_view(n, default_deadline());
+	}
 
 	std::string read(std::size_t n = 1024) {
-		 bool is_nonblocking = flags & noblocking;
-		if (is_nonblocking && !socket_has_input(readsock, timeout))
-				return "";
-	
-		return impl_readb(n);
+		return std::string(read_view(n));
+	}
+
+	/*
+		Offset just past the first occurrence of delimiter in the buffered bytes, reading more until there is one.
+		Every byte is scanned once even when the delimiter is split over reads, see delimiter_search.
+		Returns npos on end of file or when the deadline passed, the time left is recomputed for every wait.
+	*/
+	std::size_t find_until(std::string_view delimiter, std::size_t min_read, deadline until) {
+		delimiter_search search(delimiter);
+
+		while (true) {
+			std::size_t end = search.next(buffer.peek());
+			if (end != std::string_view::npos)
+				return end;
+
+			if (impl_fill(min_read, until) <= 0)
+				return std::string_view::npos;
+		}
+	}
+
+	std::size_t find_until(std::string_view delimiter, std::size_t min_read = 1024) {
+		return find_until(delimiter, min_read, default_deadline());
+	}
+
+	/* everything up to and including delimiter, or all that could be read if it never came. Valid like read_view */
+	std::string_view read_until_view(std::string_view delimiter, std::size_t min_read, deadline until) {
+		std::size_t end = find_until(delimiter, min_read, until);
+
+		return buffer.take(end == std::string_view::npos ? buffer.size() : end);
+	}
+
+	std::string_view read_until_view(std::string_view delimiter, std::size_t min_read = 1024) {
+		return read_until_view(delimiter, min_read, default_deadline());
+	}
+
+	std::string read_until(std::string_view delimiter, std::size_t min_read = 1024) {
+		return std::string(read_until_view(delimiter, min_read));
+	}
+
+	/*
+		Non-blocking primitives, used by pwn::reactor once it made the sockets non-blocking.
+		try_fill and try_write return the amount transferred (0 is end of file for try_fill) or -1 if they would block.
+	*/
+	ssize_t try_fill(std::size_t min_read = 4096) {
+		if constexpr (flags & pwnflag::uring) {
+			if (impl_stream())
+				throw std::runtime_error("io_uring backed instances can not be driven by a reactor");
+		}
+
+		while (true) {
+			ssize_t received = buffer.fill(readsock, min_read);
+			if (received >= 0)
+				return received;
+
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return -1;
+			if (errno != EINTR)
+				throw std::runtime_error(pwn::format("Could not read from sockid: {}", readsock));
+		}
+	}
+
+	ssize_t try_write(const char *what, const std::size_t length) {
+		if constexpr (flags & pwnflag::uring) {
+			if (impl_stream())
+				throw std::runtime_error("io_uring backed instances can not be driven by a reactor");
+		}
+
+		while (true) {
+			/* a peer which went away must not kill us with SIGPIPE, only sockets take MSG_NOSIGNAL though */
+			ssize_t written = is_pipe ? ::write(writesock, what, length) : ::send(writesock, what, length, MSG_NOSIGNAL);
+			if (written >= 0)
+				return written;
+
+			if (errno == ENOTSOCK) {
+				is_pipe = true;
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return -1;
+			if (errno != EINTR)
+				throw std::runtime_error(pwn::format("Could not write to sockid: {}", writesock));
+		}
+	}
+
+	/* everything buffered, valid until the next modification */
+	std::string_view buffered() {
+		return buffer.peek();
 	}
 
-	void unread(const std::string &what) {
-		buffer = what + buffer;
+	/* consumes up to n buffered bytes, the view is valid like read_view */
+	std::string_view take(std::size_t n) {
+		return buffer.take(n);
 	}
 
-	void write(const std::string &what, const std::size_t length) {
-		::write(writesock, what.c_str(), length);
+	void unread(std::string_view what) {
+		buffer.unread(what);
+	}
+
+	/*
+		Sends every piece with a single writev (more only after a short write), so the pieces of e.g. a line
+		never have to be joined first. While corked the pieces are queued instead.
+	*/
+	void write(std::initializer_list<std::string_view> pieces) {
+		if (corked) {
+			for (auto &piece : pieces)
+				queued.append(piece.data(), piece.length());
+			return;
+		}
+
+		if (uring_stream *s = impl_stream()) {
+			std::size_t length = 0;
+			for (auto &piece : pieces)
+				length += piece.length();
+
+			std::string joined;
+			joined.reserve(length);
+			for (auto &piece : pieces)
+				joined.append(piece.data(), piece.length());
+
+			s->ring.send(s, std::move(joined));
+			impl_check(s);
+			return;
+		}
+
+		iovec parts[16];
+		std::size_t count = 0;
+
+		for (auto &piece : pieces) {
+			if (count == std::size(parts)) {
+				impl_writev(parts, count);
+				count = 0;
+			}
+
+			if (!piece.empty())
+				parts[count++] = {const_cast<char *>(piece.data()), piece.length()};
+		}
+
+		impl_writev(parts, count);
+	}
+
+	void write(const char *what, const std::size_t length) {
+		write({std::string_view(what, length)});
+	}
+
+	/*
+		Queue writes until uncork, which sends all of them at once. On TCP sockets TCP_CORK is set as well
+		so the kernel keeps the data back until it fills a segment or the socket is uncorked.
+	*/
+	void cork() {
+		corked = true;
+		set_tcp_option(TCP_CORK, true);
+	}
+
+	void uncork() {
+		corked = false;
+
+		if (!queued.empty()) {
+			write(queued.data(), queued.length());
+			queued.clear();
+		}
+
+		set_tcp_option(TCP_CORK, false);
+	}
+
+	void set_nodelay(bool enable) {
+		if (!set_tcp_option(TCP_NODELAY, enable))
+			throw std::runtime_error(pwn::format("Could not set TCP_NODELAY on sockid: {}", writesock));
+	}
+
+	/* waits until everything written was sent or failed, only io_uring sends can still be in flight */
+	void flush() {
+		if (stream)
+			stream->ring.flush(stream.get());
+	}
+
+	/* hands the fds back for direct use: with io_uring the armed receive is cancelled, what it got stays buffered */
+	void settle() {
+		if (stream) {
+			stream->ring.settle(stream.get());
+			stream.reset();
+		}
 	}
 
 	const std::size_t length() {
-		return buffer.length();
+		return buffer.size();
 	}
 
 	void set_timeout(const int ms) {
 		timeout = ms;
 	}
 
+	const pwn::timeout_stats &get_timeout_stats() const {
+		return stats;
+	}
+
+	void reset_timeout_stats() {
+		stats = {};
+	}
+
 	int get_readsock() { return readsock; }
 	int get_writesock() { return writesock; }
 };
@@ -0,0 +1,272 @@
+#pragma once
+#include <cppwnlib/basic/format.hpp>
+
+#include <csignal>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+namespace pwn {
+
+/*
+	How local instances start their process, e.g.
+	pwn::instance<pwn::local>(pwn::spawn_options().env("LD_PRELOAD", "./libc.so.6").cwd("/tmp").limit(RLIMIT_CORE, 0), "./vuln")
+	Without options the process inherits environment and working directory. Our other file descriptors are
+	not inherited unless keep_fds is set or they are passed explicitly.
+*/
+struct spawn_options {
+	/* what connects a local instance to the stdin and stdout of its process */
+	enum class transport {
+		pipes,
+		socketpair
+	};
+
+	/* the whole environment as KEY=value strings, inherited when empty */
+	std::optional<std::vector<std::string>> environment;
+	std::string directory;
+	std::vector<std::pair<int, rlimit>> limits;
+	std::vector<int> passed_fds;
+	bool keep_fds = false;
+	bool trace = false;
+
+	transport connection = transport::pipes;
+	/* capacity of each direction in bytes, 0 keeps what the kernel picks */
+	std::size_t buffer_size = 0;
+
+	/* sets key in the environment, which starts out as a copy of ours */
+	spawn_options &env(std::string_view key, std::string_view value) {
+		if (!environment) {
+			environment.emplace();
+			for (char **itr = environ; *itr; itr++)
+				environment->emplace_back(*itr);
+		}
+
+		std::string entry = pwn::format("{}={}", key, value);
+		for (auto &existing : *environment) {
+			if (existing.starts_with(key) && (existing.length() > key.length()) && (existing[key.length()] == '=')) {
+				existing = std::move(entry);
+				return *this;
+			}
+		}
+
+		environment->push_back(std::move(entry));
+		return *this;
+	}
+
+	/* starts from an empty environment */
+	spawn_options &clear_env() {
+		environment.emplace();
+		return *this;
+	}
+
+	spawn_options &cwd(std::string path) {
+		directory = std::move(path);
+		return *this;
+	}
+
+	spawn_options &limit(int resource, rlim_t soft, rlim_t hard) {
+		limits.emplace_back(resource, rlimit {soft, hard});
+		return *this;
+	}
+
+	spawn_options &limit(int resource, rlim_t both) {
+		return limit(resource, both, both);
+	}
+
+	spawn_options &inherit_fds(bool keep = true) {
+		keep_fds = keep;
+		return *this;
+	}
+
+	/*
+		Sizes the pipes with F_SETPIPE_SZ (rounded up to pages by the kernel), or the socket buffers of a socketpair.
+		Pipes larger than /proc/sys/fs/pipe-max-size need CAP_SYS_RESOURCE and otherwise keep their size.
+	*/
+	spawn_options &pipe_size(std::size_t bytes) {
+		buffer_size = bytes;
+		return *this;
+	}
+
+	/*
+		Connects stdin and stdout to one end of an AF_UNIX stream socketpair instead of two pipes: a single fd to
+		wait on, and sends which never raise SIGPIPE.
+	*/
+	spawn_options &use_socketpair(bool enable = true) {
+		connection = enable ? transport::socketpair : transport::pipes;
+		return *this;
+	}
+
+	/* starts the process traced by the spawning thread, stopped right after execve until a pwn::debugger takes it */
+	spawn_options &traced(bool enable = true) {
+		trace = enable;
+		return *this;
+	}
+
+	/* lets the process inherit fd under the same number, even if it is close-on-exec */
+	spawn_options &pass_fd(int fd) {
+		passed_fds.push_back(fd);
+		return *this;
+	}
+};
+
+namespace detail {
+
+/*
+	Everything the spawned child needs, prepared by the parent: the child shares our memory and must not allocate.
+	error is where it reports why execve failed.
+*/
+struct spawn_request {
+	const char *path;
+	char *const *argv;
+	char *const *envp;
+	const spawn_options *options;
+	int stdin_fd;
+	int stdout_fd;
+	sigset_t mask;
+	int error = 0;
+};
+
+/* path as execvp would find it, searched in the parent since the child may not allocate */
+inline std::string spawn_resolve(const std::string &path) {
+	if (path.find('/') != std::string::npos)
+		return path;
+
+	const char *search = getenv("PATH");
+	std::string_view dirs = search ? search : "/bin:/usr/bin";
+
+	while (true) {
+		std::size_t end = dirs.find(':');
+		std::string_view dir = dirs.substr(0, end);
+		std::string candidate = pwn::format("{}/{}", dir.empty() ? "." : dir, path);
+
+		if (access(candidate.c_str(), X_OK) == 0)
+			return candidate;
+
+		if (end == std::string_view::npos)
+			return path;
+		dirs.remove_prefix(end + 1);
+	}
+}
+
+/* puts fd at target for the new program, also when it already is there (dup2 would keep close-on-exec then) */
+inline int spawn_place(int fd, int target) {
+	if (fd == target)
+		return fcntl(fd, F_SETFD, 0);
+
+	return dup2(fd, target);
+}
+
+inline int spawn_child(void *argument) {
+	spawn_request &request = *static_cast<spawn_request *>(argument);
+
+	/* handlers of ours must not run in the child, it still shares our memory until execve */
+	for (int sig = 1; sig < _NSIG; sig++) {
+		struct sigaction action;
+		if ((sigaction(sig, nullptr, &action) == 0) && (action.sa_handler != SIG_IGN) && (action.sa_handler != SIG_DFL)) {
+			action.sa_handler = SIG_DFL;
+			action.sa_flags = 0;
+			sigaction(sig, &action, nullptr);
+		}
+	}
+
+	sigprocmask(SIG_SETMASK, &request.mask, nullptr);
+
+	if ((spawn_place(request.stdin_fd, STDIN_FILENO) < 0) || (spawn_place(request.stdout_fd, STDOUT_FILENO) < 0))
+		goto failed;
+
+	if (!request.options->keep_fds)
+		syscall(SYS_close_range, 3, ~0u, 4 /* CLOSE_RANGE_CLOEXEC */);
+
+	for (int fd : request.options->passed_fds) {
+		if (fcntl(fd, F_SETFD, 0) < 0)
+			goto failed;
+	}
+
+	if (!request.options->directory.empty() && (chdir(request.options->directory.c_str()) < 0))
+		goto failed;
+
+	for (auto &[resource, value] : request.options->limits) {
+		if (setrlimit(resource, &value) < 0)
+			goto failed;
+	}
+
+	if (request.options->trace && (ptrace(PTRACE_TRACEME, 0, nullptr, nullptr) < 0))
+		goto failed;
+
+	execve(request.path, request.argv, request.envp);
+
+failed:
+	request.error = errno;
+	_exit(127);
+}
+
+/*
+	Starts path with argv and the pipe ends stdin_fd/stdout_fd as its stdin and stdout. The child is created with
+	clone(CLONE_VM | CLONE_VFORK) like posix_spawn does, so no page tables are copied and spawning costs the same
+	however much memory we have mapped. Throws if the program could not be executed.
+*/
+inline pid_t spawn(const std::vector<std::string> &argv, const spawn_options &options, int stdin_fd, int stdout_fd) {
+	std::string path = spawn_resolve(argv.at(0));
+
+	std::vector<char *> arguments;
+	for (auto &argument : argv)
+		arguments.push_back(const_cast<char *>(argument.c_str()));
+	arguments.push_back(nullptr);
+
+	std::vector<char *> environment;
+	if (options.environment) {
+		for (auto &entry : *options.environment)
+			environment.push_back(const_cast<char *>(entry.c_str()));
+		environment.push_back(nullptr);
+	}
+
+	spawn_request request {
+		.path = path.c_str(),
+		.argv = arguments.data(),
+		.envp = options.environment ? environment.data() : environ,
+		.options = &options,
+		.stdin_fd = stdin_fd,
+		.stdout_fd = stdout_fd,
+		.mask = {}
+	};
+
+	constexpr std::size_t stack_size = 1 << 16;
+	std::unique_ptr<char[]> stack(new char[stack_size]);
+
+	/* no signal may be handled by the child before it reset the handlers */
+	sigset_t all;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &request.mask);
+
+	pid_t pid = clone(spawn_child, stack.get() + stack_size, CLONE_VM | CLONE_VFORK | SIGCHLD, &request);
+	int clone_error = errno;
+
+	pthread_sigmask(SIG_SETMASK, &request.mask, nullptr);
+
+	if (pid < 0)
+		throw std::runtime_error(pwn::format("Could not spawn {}: errno {}", argv[0], clone_error));
+
+	if (request.error) {
+		waitpid(pid, nullptr, 0);
+		throw std::runtime_error(pwn::format("Could not execute {}: {}", argv[0], strerror(request.error)));
+	}
+
+	return pid;
+}
+
+}
+}
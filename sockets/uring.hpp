@@ -0,0 +1,580 @@
+#pragma once
+#include <cppwnlib/basic/format.hpp>
+#include <cppwnlib/sockets/ringbuffer.hpp>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+
+#include <csignal>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace pwn {
+namespace detail {
+
+class uring;
+
+/*
+	The io_uring side of one SocketBuffer: where received data goes and what is still to be sent.
+	Streams belong to the uring of the thread which opened them, once their SocketBuffer is gone they
+	are orphaned and deleted by the uring after their last request completed.
+*/
+struct uring_stream {
+	uring &ring;
+	int readsock;
+	int writesock;
+	bool is_socket;
+
+	ring_buffer *target = nullptr;
+	bool armed = false;
+	bool eof = false;
+	bool orphaned = false;
+	int error = 0;
+
+	std::deque<std::string> outgoing;
+	std::size_t sent = 0;
+	bool sending = false;
+
+	/* requests submitted for this stream which have not seen their last completion */
+	unsigned inflight = 0;
+
+	uring_stream(uring &ring, int readsock, int writesock, bool is_socket):
+		ring(ring), readsock(readsock), writesock(writesock), is_socket(is_socket) {}
+
+	struct release {
+		void operator()(uring_stream *stream) const;
+	};
+};
+
+/*
+	A minimal io_uring driven with raw syscalls, one per thread shared by every uring backed SocketBuffer on it.
+	Every send is submitted right away with an io_uring_enter of its own, so it reaches the peer even if nothing
+	waits on the instance afterwards. Receives armed while waiting go out with whatever else is queued by then.
+	Receives are multishot recvs (plain reads for pipes, single recvs before Linux 6.0) into a ring of provided
+	buffers, data is copied into the SocketBuffer's ring_buffer when the completion is reaped and the buffer
+	handed back right away.
+	Completions are reaped from the mapped completion queue without a syscall, io_uring_enter is only needed
+	to submit or when there is nothing to reap yet.
+*/
+class uring {
+private:
+	static constexpr unsigned queue_depth = 256;
+	static constexpr unsigned buffer_count = 256;
+	static constexpr unsigned buffer_size = 1 << 14;
+	static constexpr std::uint16_t buffer_group = 0;
+
+	enum class operation : std::uint64_t { receive = 0, send = 1, cancel = 2 };
+
+	int fd = -1;
+
+	void *sq_map = MAP_FAILED;
+	void *cq_map = MAP_FAILED;
+	void *sqe_map = MAP_FAILED;
+	std::size_t sq_map_size = 0;
+	std::size_t cq_map_size = 0;
+	std::size_t sqe_map_size = 0;
+
+	unsigned *sq_head, *sq_tail, *sq_array;
+	unsigned sq_mask, sq_entries;
+	io_uring_sqe *sqes;
+	unsigned *cq_head, *cq_tail;
+	unsigned cq_mask;
+	io_uring_cqe *cqes;
+	unsigned queued = 0;
+
+	/* multishot recv needs 6.0 while everything else here works from 5.19, without it every recv is a single one */
+	bool multishot = false;
+
+	/*
+		The provided buffer ring as a plain array. io_uring_buf_ring does not describe it in C++ (its flexible
+		array lands behind the tail), the tail overlays the reserved field of the first entry.
+	*/
+	io_uring_buf *buffers = static_cast<io_uring_buf *>(MAP_FAILED);
+	std::size_t buffers_size = 0;
+	char *buffer_memory = nullptr;
+
+	std::unordered_set<uring_stream *> streams;
+
+	static unsigned load(unsigned *p) {
+		return std::atomic_ref<unsigned>(*p).load(std::memory_order_acquire);
+	}
+
+	static void store(unsigned *p, unsigned value) {
+		std::atomic_ref<unsigned>(*p).store(value, std::memory_order_release);
+	}
+
+	void recycle(unsigned id) {
+		std::uint16_t tail = buffers[0].resv;
+		io_uring_buf &entry = buffers[tail & (buffer_count - 1)];
+
+		entry.addr = reinterpret_cast<std::uint64_t>(buffer_memory + id * buffer_size);
+		entry.len = buffer_size;
+		entry.bid = id;
+
+		std::atomic_ref<std::uint16_t>(buffers[0].resv).store(tail + 1, std::memory_order_release);
+	}
+
+	io_uring_sqe &next_sqe() {
+		unsigned tail = *sq_tail;
+
+		if (tail - load(sq_head) >= sq_entries) {
+			enter(0);
+			tail = *sq_tail;
+		}
+
+		io_uring_sqe &sqe = sqes[tail & sq_mask];
+		std::memset(&sqe, 0, sizeof(sqe));
+		sq_array[tail & sq_mask] = tail & sq_mask;
+
+		return sqe;
+	}
+
+	void commit() {
+		store(sq_tail, *sq_tail + 1);
+		queued++;
+	}
+
+	static std::uint64_t tag(uring_stream *stream, operation op) {
+		return reinterpret_cast<std::uint64_t>(stream) | static_cast<std::uint64_t>(op);
+	}
+
+	void submit_send(uring_stream *stream, std::uint8_t sqe_flags = 0) {
+		const std::string &front = stream->outgoing.front();
+		io_uring_sqe &sqe = next_sqe();
+
+		sqe.opcode = stream->is_socket ? IORING_OP_SEND : IORING_OP_WRITE;
+		sqe.fd = stream->writesock;
+		sqe.off = -1;
+		sqe.addr = reinterpret_cast<std::uint64_t>(front.data() + stream->sent);
+		sqe.len = front.length() - stream->sent;
+		sqe.msg_flags = stream->is_socket ? MSG_NOSIGNAL : 0;
+		sqe.flags = sqe_flags;
+		sqe.user_data = tag(stream, operation::send);
+		commit();
+
+		stream->sending = true;
+		stream->inflight++;
+	}
+
+	void handle(const io_uring_cqe &cqe) {
+		uring_stream *stream = reinterpret_cast<uring_stream *>(cqe.user_data & ~std::uint64_t(7));
+		bool last = !(cqe.flags & IORING_CQE_F_MORE);
+
+		switch (static_cast<operation>(cqe.user_data & 7)) {
+			case operation::receive:
+				if (cqe.flags & IORING_CQE_F_BUFFER) {
+					unsigned id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+
+					if ((cqe.res > 0) && !stream->orphaned)
+						stream->target->append(std::string_view(buffer_memory + id * buffer_size, cqe.res));
+					recycle(id);
+				}
+
+				if (cqe.res == 0)
+					stream->eof = true;
+				else if ((cqe.res < 0) && (cqe.res != -ENOBUFS) && (cqe.res != -ECANCELED))
+					stream->error = -cqe.res;
+
+				/* a plain read always ends, so does a multishot recv that ran out of buffers */
+				if (last) {
+					stream->armed = false;
+					stream->inflight--;
+				}
+				break;
+			case operation::send:
+				stream->sending = false;
+				stream->inflight--;
+
+				if (cqe.res < 0) {
+					stream->error = -cqe.res;
+					stream->outgoing.clear();
+					stream->sent = 0;
+					break;
+				}
+
+				stream->sent += cqe.res;
+				if (stream->sent == stream->outgoing.front().length()) {
+					stream->outgoing.pop_front();
+					stream->sent = 0;
+				}
+
+				if (!stream->outgoing.empty())
+					submit_send(stream);
+				break;
+			case operation::cancel:
+				stream->inflight--;
+				break;
+		}
+
+		if (stream->orphaned && !stream->inflight) {
+			streams.erase(stream);
+			delete stream;
+		}
+	}
+
+	void release() {
+		for (uring_stream *stream : streams)
+			delete stream;
+
+		if (buffers != MAP_FAILED)
+			munmap(buffers, buffers_size);
+		delete[] buffer_memory;
+
+		if (sqe_map != MAP_FAILED)
+			munmap(sqe_map, sqe_map_size);
+		if ((cq_map != MAP_FAILED) && (cq_map != sq_map))
+			munmap(cq_map, cq_map_size);
+		if (sq_map != MAP_FAILED)
+			munmap(sq_map, sq_map_size);
+		if (fd >= 0)
+			close(fd);
+	}
+
+	uring() {
+		try {
+			setup();
+		}
+		catch (...) {
+			release();
+			throw;
+		}
+	}
+
+	void setup() {
+		io_uring_params params {};
+		fd = syscall(__NR_io_uring_setup, queue_depth, &params);
+		if (fd < 0)
+			throw std::runtime_error("io_uring_setup failed");
+
+		if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG))
+			throw std::runtime_error("io_uring is too old");
+
+		sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		sq_map_size = cq_map_size = std::max(sq_map_size, cq_map_size);
+		sqe_map_size = params.sq_entries * sizeof(io_uring_sqe);
+
+		sq_map = mmap(nullptr, sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+		if (sq_map == MAP_FAILED)
+			throw std::runtime_error("Could not map the io_uring submission queue");
+		cq_map = sq_map;
+
+		sqe_map = mmap(nullptr, sqe_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+		if (sqe_map == MAP_FAILED)
+			throw std::runtime_error("Could not map the io_uring submission entries");
+
+		char *sq = static_cast<char *>(sq_map);
+		sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+		sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+		sq_mask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+		sq_entries = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_entries);
+		sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+		sqes = static_cast<io_uring_sqe *>(sqe_map);
+
+		char *cq = static_cast<char *>(cq_map);
+		cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+		cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+		cq_mask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+		cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+		buffers_size = buffer_count * sizeof(io_uring_buf);
+		buffers = static_cast<io_uring_buf *>(mmap(nullptr, buffers_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+		if (buffers == MAP_FAILED)
+			throw std::runtime_error("Could not allocate the io_uring buffer ring");
+
+		io_uring_buf_reg registration {};
+		registration.ring_addr = reinterpret_cast<std::uint64_t>(buffers);
+		registration.ring_entries = buffer_count;
+		registration.bgid = buffer_group;
+
+		if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0)
+			throw std::runtime_error("Could not register provided buffers with io_uring");
+
+		buffer_memory = new char[buffer_count * buffer_size];
+		for (unsigned id = 0; id < buffer_count; id++)
+			recycle(id);
+
+		multishot = probe_multishot();
+	}
+
+	/* the next completion, waiting for it. Only used before any stream exists, so nothing else can show up */
+	io_uring_cqe next_cqe() {
+		while (*cq_head == load(cq_tail))
+			enter(1);
+
+		io_uring_cqe cqe = cqes[*cq_head & cq_mask];
+		store(cq_head, *cq_head + 1);
+
+		if (cqe.flags & IORING_CQE_F_BUFFER)
+			recycle(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+
+		return cqe;
+	}
+
+	/* receives a byte over a socketpair with a multishot recv, older kernels fail it with EINVAL */
+	bool probe_multishot() {
+		int pair[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0)
+			return false;
+
+		bool supported = false;
+
+		if (write(pair[1], "", 1) == 1) {
+			io_uring_sqe &sqe = next_sqe();
+			sqe.opcode = IORING_OP_RECV;
+			sqe.ioprio = IORING_RECV_MULTISHOT;
+			sqe.fd = pair[0];
+			sqe.flags = IOSQE_BUFFER_SELECT;
+			sqe.buf_group = buffer_group;
+			commit();
+
+			io_uring_cqe cqe = next_cqe();
+			supported = cqe.res > 0;
+
+			/* a working one stays armed until the socket reaches end of file */
+			if (cqe.flags & IORING_CQE_F_MORE) {
+				shutdown(pair[1], SHUT_WR);
+				while (next_cqe().flags & IORING_CQE_F_MORE);
+			}
+		}
+
+		close(pair[0]);
+		close(pair[1]);
+		return supported;
+	}
+public:
+	uring(const uring &) = delete;
+	uring &operator=(const uring &) = delete;
+
+	~uring() {
+		release();
+	}
+
+	/* the uring of the calling thread, nullptr when the kernel does not support what it needs */
+	static uring *get() {
+		static thread_local std::unique_ptr<uring> ring;
+		static thread_local bool tried = false;
+
+		if (!tried) {
+			tried = true;
+
+			try {
+				ring.reset(new uring());
+			}
+			catch (std::runtime_error &) {}
+		}
+
+		return ring.get();
+	}
+
+	uring_stream *open(int readsock, int writesock) {
+		struct stat info;
+		bool is_socket = (fstat(readsock, &info) == 0) && S_ISSOCK(info.st_mode);
+
+		uring_stream *stream = new uring_stream(*this, readsock, writesock, is_socket);
+		streams.insert(stream);
+
+		return stream;
+	}
+
+	void orphan(uring_stream *stream) {
+		stream->orphaned = true;
+		stream->target = nullptr;
+
+		if (stream->armed) {
+			io_uring_sqe &sqe = next_sqe();
+			sqe.opcode = IORING_OP_ASYNC_CANCEL;
+			sqe.fd = -1;
+			sqe.addr = tag(stream, operation::receive);
+			sqe.user_data = tag(stream, operation::cancel);
+			commit();
+
+			stream->inflight++;
+			enter(0);
+		}
+
+		if (!stream->inflight) {
+			streams.erase(stream);
+			delete stream;
+		}
+	}
+
+	/*
+		Submits everything queued and waits for up to wait_for completions, at most timeout if it is given.
+		Returns false if the timeout passed.
+	*/
+	bool enter(unsigned wait_for, std::chrono::nanoseconds timeout = std::chrono::nanoseconds::max()) {
+		bool has_timeout = wait_for && (timeout != std::chrono::nanoseconds::max());
+		unsigned enter_flags = wait_for ? IORING_ENTER_GETEVENTS : 0;
+
+		timeout = std::max(timeout, std::chrono::nanoseconds::zero());
+		__kernel_timespec ts {timeout.count() / 1000000000, timeout.count() % 1000000000};
+		io_uring_getevents_arg arg {0, _NSIG / 8, 0, reinterpret_cast<std::uint64_t>(&ts)};
+
+		void *extra = nullptr;
+		std::size_t extra_size = 0;
+
+		if (has_timeout) {
+			enter_flags |= IORING_ENTER_EXT_ARG;
+			extra = &arg;
+			extra_size = sizeof(arg);
+		}
+
+		while (true) {
+			long submitted = syscall(__NR_io_uring_enter, fd, queued, wait_for, enter_flags, extra, extra_size);
+
+			if (submitted >= 0) {
+				queued -= std::min<unsigned>(queued, submitted);
+				return true;
+			}
+
+			if (errno == ETIME) {
+				/* the submissions went through before the wait timed out */
+				queued = *sq_tail - load(sq_head);
+				return false;
+			}
+			if ((errno != EINTR) && (errno != EBUSY) && (errno != EAGAIN))
+				throw std::runtime_error(pwn::format("io_uring_enter failed with errno {}", errno));
+		}
+	}
+
+	/* handles every completion that arrived, without a syscall */
+	std::size_t reap() {
+		std::size_t handled = 0;
+		unsigned head = *cq_head;
+
+		while (head != load(cq_tail)) {
+			io_uring_cqe cqe = cqes[head & cq_mask];
+			store(cq_head, ++head);
+
+			handle(cqe);
+			handled++;
+		}
+
+		return handled;
+	}
+
+	void arm(uring_stream *stream, std::uint8_t sqe_flags = 0) {
+		if (stream->armed || stream->eof || stream->error)
+			return;
+
+		io_uring_sqe &sqe = next_sqe();
+
+		if (stream->is_socket && multishot) {
+			sqe.opcode = IORING_OP_RECV;
+			sqe.ioprio = IORING_RECV_MULTISHOT;
+		}
+		else if (stream->is_socket) {
+			sqe.opcode = IORING_OP_RECV;
+			sqe.len = buffer_size;
+		}
+		else {
+			sqe.opcode = IORING_OP_READ;
+			sqe.off = -1;
+			sqe.len = buffer_size;
+		}
+
+		sqe.fd = stream->readsock;
+		sqe.flags = IOSQE_BUFFER_SELECT | sqe_flags;
+		sqe.buf_group = buffer_group;
+		sqe.user_data = tag(stream, operation::receive);
+		commit();
+
+		stream->armed = true;
+		stream->inflight++;
+	}
+
+	/*
+		Queues what to be sent after everything sent before and submits it. If no receive is armed yet one is
+		linked behind the send, so a request and the wait for its response go out in a single submission.
+	*/
+	void send(uring_stream *stream, std::string what) {
+		stream->outgoing.push_back(std::move(what));
+
+		if (!stream->sending) {
+			bool link = !stream->armed && !stream->eof && !stream->error;
+
+			submit_send(stream, link ? IOSQE_IO_LINK : 0);
+			if (link)
+				arm(stream);
+		}
+
+		enter(0);
+	}
+
+	/*
+		Waits until stream received more than it had (have bytes in its target), reached end of file or failed.
+		Returns false if the deadline passed first, time_point::max() waits without one.
+	*/
+	bool wait(uring_stream *stream, std::size_t have, std::chrono::steady_clock::time_point until) {
+		while (true) {
+			reap();
+
+			if ((stream->target->size() > have) || stream->eof || stream->error)
+				return true;
+
+			arm(stream);
+
+			if (until == std::chrono::steady_clock::time_point::max()) {
+				enter(1);
+				continue;
+			}
+
+			if (!enter(1, until - std::chrono::steady_clock::now())) {
+				reap();
+				return (stream->target->size() > have) || stream->eof || stream->error;
+			}
+		}
+	}
+
+	/* cancels the receive of stream and waits until nothing of it is in flight anymore, received data is kept */
+	void settle(uring_stream *stream) {
+		flush(stream);
+
+		if (stream->armed) {
+			io_uring_sqe &sqe = next_sqe();
+			sqe.opcode = IORING_OP_ASYNC_CANCEL;
+			sqe.fd = -1;
+			sqe.addr = tag(stream, operation::receive);
+			sqe.user_data = tag(stream, operation::cancel);
+			commit();
+
+			stream->inflight++;
+		}
+
+		while (stream->inflight) {
+			enter(1);
+			reap();
+		}
+	}
+
+	/* waits until everything queued on stream was sent */
+	void flush(uring_stream *stream) {
+		while (!stream->outgoing.empty() && !stream->error) {
+			reap();
+
+			if (!stream->outgoing.empty() && !stream->error)
+				enter(1);
+		}
+	}
+};
+
+inline void uring_stream::release::operator()(uring_stream *stream) const {
+	stream->ring.orphan(stream);
+}
+
+}
+}